@@ -0,0 +1,83 @@
+#include "BusHealth.h"
+
+BusHealth g_bus_health[MAX_BLINDS];
+
+// Counter values at the start of the current exchange with the blind
+BusErrors g_health_marks[MAX_BLINDS];
+
+void busHealthRequest(byte blind, bool isRetry, BusErrors *errors) {
+	g_bus_health[blind].requests++;
+	if (isRetry) {
+		g_bus_health[blind].retries++;
+		return;
+	}
+	g_health_marks[blind].checksum = errors->checksum;
+	g_health_marks[blind].parity = errors->parity;
+	g_health_marks[blind].framing = errors->framing;
+}
+
+void busHealthReply(byte blind, word latency) {
+	BusHealth *h = &g_bus_health[blind];
+	h->replies++;
+
+	byte bucket = 0;
+	while(latency > 1 && bucket < LATENCY_BUCKETS - 1) {
+		latency >>= 1;
+		bucket++;
+	}
+	if (h->latency[bucket] == 0xFF) {
+		// Keep the shape of the histogram, but forget the old data
+		for(byte i=0; i<LATENCY_BUCKETS; ++i) {
+			h->latency[i] >>= 1;
+		}
+	}
+	h->latency[bucket]++;
+}
+
+void busHealthEnd(byte blind, BusErrors *errors) {
+	BusHealth *h = &g_bus_health[blind];
+	h->checksumErrors += errors->checksum - g_health_marks[blind].checksum;
+	h->parityErrors += errors->parity - g_health_marks[blind].parity;
+	h->framingErrors += errors->framing - g_health_marks[blind].framing;
+}
+
+void resetBusHealth() {
+	for(byte i=0; i<MAX_BLINDS; ++i) {
+		for(byte k=0; k<sizeof(BusHealth); ++k) {
+			((byte*)&g_bus_health[i])[k] = 0;
+		}
+	}
+}
+
+void dumpBusHealth(byte numBlinds) {
+	Serial.println("Blind: req/rep/retry cksum/parity/framing latency histogram");
+	for(byte i=0; i<numBlinds; ++i) {
+		BusHealth *h = &g_bus_health[i];
+		Serial.print(i); Serial.print(": ");
+		Serial.print(h->requests); Serial.print("/");
+		Serial.print(h->replies); Serial.print("/");
+		Serial.print(h->retries); Serial.print(" ");
+		Serial.print(h->checksumErrors); Serial.print("/");
+		Serial.print(h->parityErrors); Serial.print("/");
+		Serial.print(h->framingErrors); Serial.print(" ");
+		for(byte k=0; k<LATENCY_BUCKETS; ++k) {
+			Serial.print(h->latency[k]);
+			Serial.print(" ");
+		}
+		Serial.println();
+	}
+}
+
+void publishBusHealth(byte numBlinds) {
+#ifdef BUS_HEALTH_CFG_PARAMS
+	for(byte i=0; i<numBlinds; ++i) {
+		BusHealth *h = &g_bus_health[i];
+		word replyRate = 0;
+		if (h->requests) {
+			replyRate = dword(h->replies) * 100 / h->requests;
+		}
+		zunoSaveCFGParam(BUS_HEALTH_FIRST_PARAM + i*2, replyRate);
+		zunoSaveCFGParam(BUS_HEALTH_FIRST_PARAM + i*2 + 1, h->retries);
+	}
+#endif
+}
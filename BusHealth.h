@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Logic.h"
+
+// Publish the per-blind summary as Z-Wave configuration parameters
+//#define BUS_HEALTH_CFG_PARAMS
+// Parameters BUS_HEALTH_FIRST_PARAM + 2*i and BUS_HEALTH_FIRST_PARAM + 2*i + 1
+// hold the reply rate (in percent) and the number of retries of the blind i.
+#define BUS_HEALTH_FIRST_PARAM 72
+
+// Reply latency histogram, bucket N counts the latencies in [2^N; 2^(N+1)) ms,
+// the first bucket also includes 0 ms and the last one everything longer.
+#define LATENCY_BUCKETS 8
+
+// Per-blind bus statistics
+struct BusHealth {
+	word requests, replies, retries;
+	word checksumErrors, parityErrors, framingErrors;
+	byte latency[LATENCY_BUCKETS];
+};
+
+// The receive error counters of the bus the blind is on
+struct BusErrors {
+	word checksum, parity, framing;
+};
+
+extern BusHealth g_bus_health[MAX_BLINDS];
+
+// A status request is about to be sent to the blind. The errors that
+// happen on its bus from the first attempt until busHealthEnd() are
+// attributed to this blind. The blinds on different buses are polled at
+// the same time, so each one keeps its own marks.
+void busHealthRequest(byte blind, bool isRetry, BusErrors *errors);
+void busHealthReply(byte blind, word latency);
+void busHealthEnd(byte blind, BusErrors *errors);
+
+void resetBusHealth();
+// Print the statistics table to the debug serial
+void dumpBusHealth(byte numBlinds);
+void publishBusHealth(byte numBlinds);
@@ -0,0 +1,79 @@
+#include "Button.h"
+
+byte g_btn_pin;
+// The last sample and the time it changed
+byte g_btn_raw;
+dword g_btn_raw_since, g_btn_sampled;
+// The debounced state
+byte g_btn_pressed;
+dword g_btn_pressed_at, g_btn_released_at;
+byte g_btn_clicks;
+// The long hold has been reported for the current press
+byte g_btn_long_reported;
+// The gesture waiting for buttonGesture()
+byte g_btn_gesture;
+word g_btn_gesture_arg;
+
+void buttonBegin(byte pin) {
+	g_btn_pin = pin;
+	pinMode(pin, INPUT_PULLUP);
+}
+
+static void reportGesture(byte gesture, word arg) {
+	g_btn_gesture = gesture;
+	g_btn_gesture_arg = arg;
+}
+
+void buttonService() {
+	dword now = millis();
+	if (now - g_btn_sampled < BTN_SAMPLE_INTERVAL) {
+		return;
+	}
+	g_btn_sampled = now;
+
+	byte raw = digitalRead(g_btn_pin) == LOW;
+	if (raw != g_btn_raw) {
+		g_btn_raw = raw;
+		g_btn_raw_since = now;
+	} else if (raw != g_btn_pressed && now - g_btn_raw_since >= BTN_DEBOUNCE) {
+		// The press and the release times are those of the first edge
+		g_btn_pressed = raw;
+		if (raw) {
+			g_btn_pressed_at = g_btn_raw_since;
+			g_btn_long_reported = 0;
+		} else {
+			dword held = g_btn_raw_since - g_btn_pressed_at;
+			g_btn_released_at = g_btn_raw_since;
+			if (g_btn_long_reported) {
+				// Already reported
+			} else if (held <= BTN_CLICK_MAX) {
+				g_btn_clicks++;
+			} else {
+				g_btn_clicks = 0;
+				reportGesture(GESTURE_HOLD, held > 0xFFFF ? 0xFFFF : word(held));
+			}
+		}
+	}
+
+	if (g_btn_pressed) {
+		if (!g_btn_long_reported && now - g_btn_pressed_at >= BTN_LONG_HOLD) {
+			g_btn_long_reported = 1;
+			g_btn_clicks = 0;
+			reportGesture(GESTURE_LONG_HOLD, 0);
+		}
+	} else if (g_btn_clicks && now - g_btn_released_at >= BTN_CLICK_GAP) {
+		reportGesture(GESTURE_CLICKS, g_btn_clicks);
+		g_btn_clicks = 0;
+	}
+}
+
+bool buttonPressed() {
+	return g_btn_pressed;
+}
+
+byte buttonGesture(word *arg) {
+	byte gesture = g_btn_gesture;
+	*arg = g_btn_gesture_arg;
+	g_btn_gesture = GESTURE_NONE;
+	return gesture;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Recognises the gestures of a push button without blocking. The button is
+// sampled by buttonService(), which is cheap and should be called from all
+// the waiting loops, and the state advances on the sample timestamps. The
+// recognised gesture is kept until buttonGesture() picks it up.
+
+// The level has to stay the same for this long to count
+#define BTN_DEBOUNCE 30 // ms
+// The button isn't sampled more often than this
+#define BTN_SAMPLE_INTERVAL 10 // ms
+// A press up to this long is a click
+#define BTN_CLICK_MAX 500 // ms
+// The clicks closer than this make up one gesture
+#define BTN_CLICK_GAP 400 // ms
+// A press this long is reported while the button is still held
+#define BTN_LONG_HOLD 8000 // ms
+
+#define GESTURE_NONE 0
+#define GESTURE_CLICKS 1    // arg: number of clicks
+#define GESTURE_HOLD 2      // the button was released, arg: press time in ms
+#define GESTURE_LONG_HOLD 3 // the button is held for BTN_LONG_HOLD, no release follows
+
+// The button connects the pin to the ground
+void buttonBegin(byte pin);
+void buttonService();
+// The debounced state of the button
+bool buttonPressed();
+// Pick up the last gesture, GESTURE_NONE if there was none
+byte buttonGesture(word *arg);
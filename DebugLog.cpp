@@ -0,0 +1,60 @@
+#include "DebugLog.h"
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+
+LogRecord g_log[LOG_RECORDS];
+byte g_log_write_pos = 0;
+byte g_log_read_pos = 0;
+word g_log_dropped = 0;
+
+void logEvent(byte event, byte blind, word arg) {
+	byte next = (g_log_write_pos + 1) & (LOG_RECORDS - 1);
+	if (next == g_log_read_pos) {
+		// Full, keep the older records
+		g_log_dropped++;
+		return;
+	}
+	LogRecord *rec = &g_log[g_log_write_pos];
+	rec->event = event;
+	rec->blind = blind;
+	rec->arg = arg;
+	rec->timestamp = millis();
+	g_log_write_pos = next;
+}
+
+void writeLogByte(byte b, byte *checksum) {
+	Serial.write(b);
+	*checksum += b;
+}
+
+void writeLogRecord(LogRecord *rec) {
+	byte checksum = 0;
+	writeLogByte(LOG_SYNC, &checksum);
+	writeLogByte(rec->event, &checksum);
+	writeLogByte(rec->blind, &checksum);
+	writeLogByte(byte(rec->arg), &checksum);
+	writeLogByte(byte(rec->arg >> 8), &checksum);
+	writeLogByte(byte(rec->timestamp), &checksum);
+	writeLogByte(byte(rec->timestamp >> 8), &checksum);
+	writeLogByte(byte(rec->timestamp >> 16), &checksum);
+	writeLogByte(byte(rec->timestamp >> 24), &checksum);
+	Serial.write(checksum);
+}
+
+void flushLog() {
+	while(g_log_read_pos != g_log_write_pos) {
+		writeLogRecord(&g_log[g_log_read_pos]);
+		g_log_read_pos = (g_log_read_pos + 1) & (LOG_RECORDS - 1);
+	}
+	if (g_log_dropped) {
+		LogRecord rec;
+		rec.event = EV_LOG_DROPPED;
+		rec.blind = LOG_NO_BLIND;
+		rec.arg = g_log_dropped;
+		rec.timestamp = millis();
+		writeLogRecord(&rec);
+		g_log_dropped = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Binary event log. Events are stored as fixed-size records in a RAM ring
+// buffer and sent to the debug serial only when the loop is idle, so the
+// bus exchanges are not held up by formatting and sending text.
+// Use logdecoder.py to print the log as text.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_DEBUG 2
+// Events above this level compile to nothing
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Event ids, keep in sync with logdecoder.py
+#define EV_LOG_DROPPED 1       // arg: number of the dropped records
+#define EV_NEW_POSITION 2      // arg: position
+#define EV_OFFLINE 3
+#define EV_DISCOVERED 4        // blind: addr3, arg: addr2 << 8 | addr1
+#define EV_COMMAND_ALL 5       // arg: Z-Wave value
+#define EV_COMMAND_DIRECT 6    // arg: Z-Wave value
+#define EV_MOVE_UP 7
+#define EV_MOVE_DOWN 8
+#define EV_MOVE_TO 9           // arg: position
+#define EV_STOPPED 10
+#define EV_FINISHED 11
+#define EV_TIMED_OUT 12
+#define EV_REPORT_IMPORTANT 13
+#define EV_REPORT_ROUTINE 14
+#define EV_OLED_RESET 15
+#define EV_GROUP_PLANNED 16    // blind: number of blinds, arg: arrival spread in ms
+#define EV_GROUP_ARRIVED 17    // blind: number of blinds, arg: arrival spread in ms
+#define EV_SCENE_RUN 18        // blind: number of blinds, arg: scene
+#define EV_SCENE_STORED 19     // blind: number of blinds, arg: scene
+#define EV_ONLINE_DISCOVERY 20 // blind: number of motors added, arg: 1 - started, 0 - ended
+#define EV_LOOP_OVERRUN 21     // blind: the longest phase, arg: its time in ms
+#define EV_WATCHDOG_RESET 22   // blind: the phase the watchdog fired in
+
+#define LOG_NO_BLIND 0xFFu
+
+// The record on the wire: [LOG_SYNC, event, blind, arg (LE), timestamp (LE), checksum]
+#define LOG_SYNC 0xA5u
+#define LOG_RECORDS 32 // !!! HAVE to be 2^n
+
+struct LogRecord {
+	byte event, blind;
+	word arg;
+	dword timestamp;
+};
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+void logEvent(byte event, byte blind, word arg);
+// Send out the buffered records
+void flushLog();
+#else
+#define flushLog()
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(event, blind, arg) logEvent(event, blind, arg)
+#else
+#define LOG_INFO(event, blind, arg)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(event, blind, arg) logEvent(event, blind, arg)
+#else
+#define LOG_DEBUG(event, blind, arg)
+#endif
@@ -117,6 +117,7 @@ void OLED_SetAdress() {
 // -----------------------------------------------------
 OLED::OLED(){ 
 	setFont(SmallFont);
+	start_page = 0;
 }
 void OLED::begin()
 {
@@ -152,6 +153,7 @@ void OLED::begin()
 
 	cx = 0; 
 	cy = 0;
+	start_page = 0;
 
 }
 void OLED::clrscr()
@@ -258,9 +260,31 @@ void OLED::on() {
 void OLED::off() {
 	_sendTWIcommand(SSD1306_DISPLAY_OFF);
 }
+bool OLED::isResponding() {
+	Wire.beginTransmission(SSD1306_ADDR);
+	return Wire.endTransmission() == 0;
+}
 void OLED::gotoXY(byte x, byte y) {
 	cx = x;
-	cy = y;
+	cy = (y + start_page)%8;
+}
+void OLED::clearRow(byte y) {
+	y = (y + start_page)%8;
+	_sendTWIAddr(0,127,y,y);
+	Wire.beginTransmission(SSD1306_ADDR);
+  	Wire.write(SSD1306_DATA_CONTINUE);
+  	g_oled_count = 128;
+  	while(g_oled_count--)
+		Wire.write(0x00);
+	Wire.endTransmission();
+}
+void OLED::setStartPage(byte page) {
+	start_page = page%8;
+	// The start line is in pixels, each page is 8 lines high
+	_sendTWIcommand(SSD1306_SET_START_LINE | (start_page << 3));
+}
+byte OLED::startPage() {
+	return start_page;
 }
 void OLED::setBrightness(uint8_t value) {
 	_sendTWIcommand(SSD1306_SET_CONTRAST_CONTROL);
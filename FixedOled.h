@@ -55,8 +55,18 @@ class OLED:public Print
 		void 	gotoXY(byte x, byte y);
 		void  off();
 		void  on();
+		// Checks that the controller still acknowledges its I2C address
+		bool  isResponding();
     void  setFont(char * font);
     void  fillRect(byte w, byte h, byte fill);
+    // Blanks one row with a single data transfer
+    void  clearRow(byte y);
+    // Hardware scrolling: the controller starts displaying from the given
+    // page, so the whole picture moves without re-sending GDDRAM.
+    // y-coords passed to gotoXY() and clearRow() are relative to the top
+    // of the visible screen.
+    void  setStartPage(byte page);
+    byte  startPage();
 		virtual void write(uint8_t value);
     
 	protected:
@@ -64,6 +74,7 @@ class OLED:public Print
     byte  symbol_w,symbol_h;
     byte  start_symbol;  
 		byte * curr_font;
+    byte  start_page;
 
 
 };
@@ -0,0 +1,64 @@
+#include "FrameParser.h"
+
+void frameParserReset(FrameParser *parser) {
+	parser->state = FRAME_WAIT_ID;
+}
+
+bool frameParserFeed(FrameParser *parser, byte b) {
+	switch(parser->state) {
+	case FRAME_WAIT_ID:
+		parser->msgId = b;
+		parser->checksum = b;
+		parser->state = FRAME_WAIT_LEN;
+		return false;
+
+	case FRAME_WAIT_LEN:
+		// The frame length includes the msgId, length and checksum bytes
+		b = 0xFF - b;
+		if (b < 5 || b - 4 > MAX_FRAME_PAYLOAD) {
+			// Not a frame start, try the next byte
+			frameParserReset(parser);
+			return false;
+		}
+		parser->checksum += byte(0xFF - b);
+		parser->payloadLen = b - 4;
+		parser->pos = 0;
+		parser->state = FRAME_PAYLOAD;
+		return false;
+
+	case FRAME_PAYLOAD:
+		parser->payload[parser->pos++] = b;
+		parser->checksum += b;
+		if (parser->pos == parser->payloadLen) {
+			parser->state = FRAME_CHECKSUM1;
+		}
+		return false;
+
+	case FRAME_CHECKSUM1:
+		parser->checksum1 = b;
+		parser->state = FRAME_CHECKSUM2;
+		return false;
+	}
+
+	// FRAME_CHECKSUM2
+	frameParserReset(parser);
+	if (parser->checksum1 != parser->checksum / 256 || b != parser->checksum % 256) {
+		parser->checksumErrors++;
+		return false;
+	}
+	return true;
+}
+
+byte frameParserMissing(FrameParser *parser) {
+	switch(parser->state) {
+	case FRAME_WAIT_ID:
+		return 0;
+	case FRAME_WAIT_LEN:
+		return 1;
+	case FRAME_PAYLOAD:
+		return parser->payloadLen - parser->pos + 2;
+	case FRAME_CHECKSUM1:
+		return 2;
+	}
+	return 1; // FRAME_CHECKSUM2
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Incremental parser of the Somfy frames:
+// [msgId, 0xFF - frameLen, payload..., checksum1, checksum2]
+// The payload starts with the reserved byte. Bytes are fed one at a time,
+// so the parser can run on everything that's received from the bus.
+
+#define MAX_FRAME_PAYLOAD 24
+
+#define FRAME_WAIT_ID 0
+#define FRAME_WAIT_LEN 1
+#define FRAME_PAYLOAD 2
+#define FRAME_CHECKSUM1 3
+#define FRAME_CHECKSUM2 4
+
+struct FrameParser {
+	byte state;
+	byte msgId, payloadLen, pos;
+	word checksum;
+	byte checksum1;
+	byte payload[MAX_FRAME_PAYLOAD];
+	// Checksum failures of this parser, the reset doesn't clear them
+	word checksumErrors;
+};
+
+void frameParserReset(FrameParser *parser);
+// Returns true when the byte completes a frame with a valid checksum, the
+// frame stays in the parser until the next byte is fed.
+bool frameParserFeed(FrameParser *parser, byte b);
+// Bytes still missing from the frame that is being received, 0 between the
+// frames. Before the length byte arrives only that byte is counted.
+byte frameParserMissing(FrameParser *parser);
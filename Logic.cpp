@@ -2,15 +2,38 @@
 #include "OddSoftSer.h"
 #include "FixedOled.h"
 #include "EEPROM.h"
+#include "LoopStats.h"
+#include "LoopBudget.h"
+#include "BusHealth.h"
+#include "FrameParser.h"
+#include "DebugLog.h"
+#include "ReportShaper.h"
+#include "Button.h"
+#include "Logic.h"
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wwritable-strings"
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 // Definitions
-OddSoftSer blindsSerial(16, 15); // RX, TX
+// The pins are defined in OddSoftSer.h
+OddSoftSer blindsSerial(SOFT_SERIAL_TX_PIN_0, SOFT_SERIAL_RX_PIN_0, SOFT_SERIAL_DIR_PIN_0);
+#if NUM_BUSES > SOFT_SERIAL_PORTS
+#error "OddSoftSer can't service that many buses"
+#endif
+#if NUM_BUSES > 1
+OddSoftSer blindsSerial2(SOFT_SERIAL_TX_PIN_1, SOFT_SERIAL_RX_PIN_1, SOFT_SERIAL_DIR_PIN_1);
+OddSoftSer *buses[NUM_BUSES] = {&blindsSerial, &blindsSerial2};
+#else
+OddSoftSer *buses[NUM_BUSES] = {&blindsSerial};
+#endif
 OLED oled;
 
 #define BTN_PIN 18
+// A hold between these times starts the learn mode
+#define BTN_LEARN_MIN 2000
+#define BTN_LEARN_MAX 6000
+// The scene that a double click runs
+#define BTN_SCENE 1
 
 // Somfy protocol stuff
 #define DISCOVER_ALL_MOTORS 0xBFu
@@ -23,10 +46,17 @@ OLED oled;
 
 //#define DEBUG_PRINT
 
+// Listen to the bus all the time, so that the frames of the other
+// controllers update the blinds. Without it the soft serial interrupt is
+// stopped once the replies to our own frames are in.
+#define BUS_PASSIVE_LISTEN
+
 // The shutters
 struct Blinds {
 	// Obfuscated wire address, see: https://blog.baysinger.org/2016/03/somfy-protocol.html
 	byte addr1, addr2, addr3;
+	// The bus the motor is on
+	byte bus;
 //	// Min and max settings (in ticks)
 //	word minPos, maxPos;
 	byte curPercentage;
@@ -37,45 +67,255 @@ struct Blinds {
 	// Commanded position
 	byte commanded, commandedPercent;
 	byte commandSent, commandAcked;
+	// The time the command is due, a group move can put it in the future.
+	// The command timeout counts from it.
 	dword commandedTime;
+	// The blind is a part of the group move that is being timed
+	byte inGroup;
 	// Jamming detection
-	dword lastChangedTime, lastPosition;
+	dword lastChangedTime;
 	dword unjamTryCount, lastUnjamTryTime;
 
+	// The fine position reported by the motor, in its own ticks, and the
+	// number of replies in a row that reported the same ticks
+	word ticks;
+	byte ticksStable;
+	// Tick to percent calibration: the ticks of the replies with the lowest
+	// and the highest percentage seen so far, calPctLow is 0xFF if none
+	word calTicksLow, calTicksHigh;
+	byte calPctLow, calPctHigh;
+
+	// Travel rate measured on the previous moves, in 0.01% per second
+	word travelRate;
+	// The move being timed: the fine position before the motor started and
+	// the time of the first reply that showed the motion, 0 if not timed
+	word moveStartPos;
+	dword moveStartTime;
+
 	// Health status
 	dword lastTimeUpdated;
 	byte isOffline;
+	// Offline blinds are probed with a single request at growing intervals
+	dword lastProbeTime;
+	word probeDelay;
+	// Moving average of the status request success, 255 - every request is
+	// answered. It selects the number of retries and command copies.
+	byte linkQuality;
+
+	// The position stored in the EEPROM cache, and whether the position has
+	// been confirmed by the motor since the boot
+	byte savedPercentage;
+	byte positionVerified;
 };
-#define MAX_BLINDS 4
 #define OFFLINE_TIMEOUT 30000
+#define OFFLINE_PROBE_MIN_DELAY 2000
+#define OFFLINE_PROBE_MAX_DELAY 60000
+// New motors start at the old fixed policy of two copies
+#define LINK_QUALITY_INITIAL 204
+// The average moves by 1/2^LINK_QUALITY_SHIFT of the difference per request
+#define LINK_QUALITY_SHIFT 3
+#define MAX_STATUS_ATTEMPTS 5
+#define MAX_COMMAND_COPIES 3
+// The payload of the move command, the longest frame we send
+#define MOVE_PAYLOAD_LEN 10
+
+// The ticks are trusted for the positioning once the calibration points are
+// this many percent apart
+#define TICKS_CAL_MIN_SPAN 30
+// A move is finished within this distance of the target, in 0.1%
+#define ARRIVED_TOLERANCE 20
+// A motor that has stopped this close to the target is not going to get
+// any closer, in 0.1%
+#define STOPPED_TOLERANCE 40
+// The ticks didn't change on this many replies in a row, the motor has
+// stopped short of the target
+#define STALL_REPLIES 2
+#define JAM_TIMEOUT 4000
+
+// A position is stored once the blind has stayed there for this long, so
+// the moves don't wear the EEPROM
+#define POSITION_SAVE_DELAY 60000
+#define TRAVEL_RATE_UNKNOWN 0xFFFFu
+// Assumed for the blinds that haven't made a timed move yet, 3% per second
+#define TRAVEL_RATE_DEFAULT 300
+// The stored rate is rewritten only when the measured one has drifted from
+// it by more than 1/TRAVEL_RATE_SAVE_SHARE (5%), so the moves don't wear the
+// EEPROM
+#define TRAVEL_RATE_SAVE_SHARE 20
+// Only the moves this long are timed, in 0.1%
+#define TRAVEL_MIN_DISTANCE 200
+// No blind in a group move is held back for longer than this
+#define GROUP_MAX_DELAY 30000
+
+// The group move that is being timed: the blinds that haven't arrived yet,
+// the arrivals so far and the spreads of the arrival times in ms. The
+// unplanned spread is what it would have been without the planning.
+byte groupRemaining, groupArrivals;
+dword groupFirstArrival, groupLastArrival;
+word groupUnplannedSpread, groupPlannedSpread, groupActualSpread;
+
+// Scenes: sets of the blind positions stored in the EEPROM as ready move
+// frames, so a scene goes out as one burst. The controller sets
+// SCENE_RUN_PARAM to N to run the scene N, and SCENE_STORE_PARAM to N to
+// store the current positions as the scene N. Both are cleared once done.
+#define SCENE_RUN_PARAM 64
+#define SCENE_STORE_PARAM 65
+// The scene to run with the next commands, 0 if none
+byte pendingScene;
+
+// Online discovery: in the operation mode the discovery broadcasts go out
+// when there are no commands to send, and the motors that answer are added
+// after the known ones. The controller sets DISCOVERY_PARAM to 1 to start it.
+#define DISCOVERY_PARAM 66
+#define ONLINE_DISCOVERY_TIME 300000
+#define ONLINE_DISCOVERY_INTERVAL 1000
+dword onlineDiscoveryStarted, lastDiscoveryTime;
+byte onlineDiscovery, onlineDiscoveryAdded;
 
 Blinds blinds[MAX_BLINDS];
 byte numBlinds = 0;
 
+// Stop requests from Z-Wave take a priority lane: the stop frame is sent from
+// any wait in the loop as soon as the request arrives, instead of waiting for
+// the next processCommandedStatus() pass.
+volatile byte stopRequested;
+byte stopDuplicatesPending;
+dword stopRequestedTime;
+// Stop request to wire latency, ms
+word lastStopLatency, maxStopLatency;
+#define STOP_POLL_INTERVAL 2
+// Nothing has moved for a while, the idle pause can look less often. A stop
+// request then waits up to this long, but it has nothing to stop.
+#define IDLE_POLL_INTERVAL 10
+
 // The global mode
 enum mode_t {DISCOVERY, JOINING, OPERATION};
 mode_t globalMode;
 dword lastInterestingTime, lastTimeRead, learningStarted;
 dword lastReportSent;
-byte oledIsOff;
+
+// The OLED is dimmed and then switched off after a period of inactivity.
+// The controller keeps GDDRAM contents while it's off, so waking it up is
+// just a couple of commands.
+enum oled_power_t {OLED_POWER_ON, OLED_POWER_DIM, OLED_POWER_OFF};
+oled_power_t oledPower;
+#define OLED_DIM_TIMEOUT 30000
+#define OLED_OFF_TIMEOUT 60000
+#define OLED_BRIGHTNESS 0xCFu // The default from OLED::begin()
+#define OLED_DIM_BRIGHTNESS 0x01u
+
+// Status screen layout: row 0 is unused, the status header starts at row 1
+// and the blinds list takes the rest of the screen.
+#define OLED_ROWS 8
+#define OLED_HEADER_ROW 1
+// If the blinds list doesn't fit, advance it by one row this often
+#define OLED_SCROLL_INTERVAL 3000
+
+// What is currently drawn on each physical OLED page, so that only the
+// changed rows are re-sent over I2C. Hardware scrolling moves the pages
+// around without touching their content.
+struct OledRow {
+	byte blind; // Blind index or one of the OLED_ROW_* markers
+	byte percentage, commandedPercent, flags;
+};
+#define OLED_ROW_EMPTY 0xFFu
+#define OLED_ROW_HEADER 0xFEu
+#define OLED_ROW_HINT 0xFDu
+#define OLED_ROW_OFFLINE 0x01u
+#define OLED_ROW_COMMANDED 0x02u
+
+OledRow oledRows[OLED_ROWS];
+byte oledFirstBlind;
+dword oledLastScrollTime;
 
 void initOled();
+void wakeOled();
+void clearScreen();
 void printStatus();
 
 void runDiscoveryAttempt();
-bool readWithTimeout(byte *string, word *pInt);
-void initMotor(byte i, byte i1, byte i2);
+void waitDiscoveryReplies();
+void initMotor(byte addr1, byte addr2, byte addr3, byte bus);
+void appendMotor(byte addr1, byte addr2, byte addr3, byte bus);
+void startOnlineDiscovery();
 bool readMotorStates();
 void readMode();
 void setMode(mode_t mode);
 void loadBlinds();
 void saveBlindSettings();
+void savePositions();
 
 void setupChannels();
-
-void processCommandedStatus(bool *hasCommanded, bool *shouldSendReport);
-
-void sendReportThrottled(bool important);
+void updateZwaveValues();
+
+void processCommandedStatus(bool *hasCommanded);
+void storeScene(byte n);
+void updateEeprom(word addr, byte value);
+
+void sendReportThrottled();
+void reportBlind(byte i);
+
+bool serviceStopLane();
+void serviceDelay(word ms);
+void idleDelay(word ms);
+byte commandCopies(byte i);
+
+// All the received bytes go through the frame parser of their bus, so that
+// the frames meant for other controllers also update the blinds.
+FrameParser busParsers[NUM_BUSES];
+dword lastBusByteTime[NUM_BUSES], busFrameStartTime[NUM_BUSES];
+// A blind state was updated from the bus traffic
+byte busChanged;
+// A frame that stalls for this long is abandoned
+#define FRAME_GAP_TIMEOUT 10
+
+// 4800 baud with 8 data bits, a parity and a stop bit
+#define BUS_BYTE_TIME_US 2292u
+// The time it takes to transfer the given number of bytes, in ms
+#define FRAME_TIME(len) word((dword(len) * BUS_BYTE_TIME_US + 999) / 1000)
+// The usual silence before a motor starts to reply, the waits for the
+// replies to the broadcasts and the commands end after this much quiet
+#define MOTOR_REPLY_DELAY 20
+// A status reply that hasn't started this long after the request is a miss.
+// The polling used to wait 80 ms before reading the reply, the slow motors
+// that it heard are still heard. The latency histogram of the bus health
+// stats shows how much of it the motors of a site need.
+#ifndef MOTOR_REPLY_TIMEOUT
+#define MOTOR_REPLY_TIMEOUT 80
+#endif
+// The motors spread their HERE_IS_MOTOR replies over a window after the
+// discovery broadcast: the reply delay, the 100 ms that the discovery has
+// always listened for, and the random spread of the replies
+#define DISCOVERY_REPLY_WINDOW 160
+
+// The status request that is in flight on each bus
+struct BusPoll {
+	byte blind; // NO_POLL if the bus is done for this pass
+	byte attempt, attempts;
+	byte replied;
+	// The end of the last request, the reply delay counts from it
+	dword sentTime;
+	// The next blind to look at, and the first one that was left for the
+	// next loop, NO_POLL if none
+	byte next, resume;
+};
+#define NO_POLL 0xFFu
+BusPoll busPolls[NUM_BUSES];
+// The expected time of a status request and its reply
+#define POLL_COST (FRAME_TIME(11) + MOTOR_REPLY_DELAY + FRAME_TIME(15))
+// The polling pass ran out of the loop budget, the next loop goes on with it
+byte pollPassPending;
+
+// Redrawing all the rows of the status screen
+#define STATUS_COST 60
+// The status screen is redrawn once the budget allows, but it doesn't wait
+// for more than this many loops
+#define STATUS_MAX_WAIT 3
+// The status screen is out of date, the number of loops it has waited
+byte statusPending;
+
+void pumpBus();
+void waitBusQuiet(word quietTime);
 
 void my_memzero(void *ptr, word sz) {
 	for(word i=0; i<sz; ++i) {
@@ -89,14 +329,20 @@ void real_setup() {
     Serial.println("Initializing");
 
 	initOled();
-	pinMode(BTN_PIN, INPUT_PULLUP);  // set button pin as Input
+	buttonBegin(BTN_PIN);
 
 	// Disable the hardware serial
 	pinMode(7, INPUT);
 	pinMode(8, INPUT);
 
-	// Set up the software serial for blinds communication
-	blindsSerial.begin(4800);
+	// Set up the software serial for blinds communication, all the ports
+	// share the timer interrupt
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		buses[b]->begin();
+#ifdef BUS_PASSIVE_LISTEN
+		buses[b]->listen(true);
+#endif
+	}
 
 	lastReportSent = 0;
 	learningStarted = 0;
@@ -106,11 +352,26 @@ void real_setup() {
 	if (globalMode == JOINING || globalMode == OPERATION) {
 		loadBlinds();
 		setupChannels();
+		// Let the controller know the cached positions right away. If all
+		// of them are known there's no hurry to poll, the poller verifies
+		// them on its usual schedule.
+		bool allCached = true;
+		for(byte i=0; i<numBlinds; ++i) {
+			if (blinds[i].curPercentage == 255) {
+				allCached = false;
+			} else if (globalMode == OPERATION) {
+				reportBlind(i);
+			}
+		}
+		updateZwaveValues();
+		lastTimeRead = allCached ? millis() : 0;
 	} else {
 		numBlinds = 0;
 	}
 
 	printStatus();
+	watchdogBegin(WATCHDOG_ADDR);
+	g_soft_serial_wait = watchdogService;
 }
 
 bool differsBy(dword v1, dword v2, dword diff) {
@@ -120,6 +381,11 @@ bool differsBy(dword v1, dword v2, dword diff) {
 	return v2 - v1 >= diff;
 }
 
+// Whether the time t1 comes before t2, across the millis() wraparound
+bool isBefore(dword t1, dword t2) {
+	return dword(t1 - t2) >= 0x80000000u;
+}
+
 void setupChannels() {
 	ZUNO_START_CONFIG();
 	// The overall switch - it maps to the main endpoint of the device
@@ -140,7 +406,7 @@ void updateServiceLed() {
 }
 
 void readMode() {
-	globalMode = (mode_t)EEPROM.read(1);
+	globalMode = (mode_t)EEPROM.read(MODE_ADDR);
 	if (globalMode > OPERATION) {
 		globalMode = DISCOVERY;
 	}
@@ -151,14 +417,14 @@ void readMode() {
 
 void setMode(mode_t mode) {
 	if (globalMode != mode) {
-		EEPROM.write(1, mode);
+		EEPROM.write(MODE_ADDR, mode);
 		globalMode = mode;
 	}
 	updateServiceLed();
 }
 
 void loadBlinds() {
-	byte pos = 2;
+	byte pos = NUM_BLINDS_ADDR;
 	numBlinds = EEPROM.read(pos++);
 	if (numBlinds > MAX_BLINDS) {
 		numBlinds = 0;
@@ -170,16 +436,70 @@ void loadBlinds() {
 		blinds[i].curPercentage = 255;
 		blinds[i].lastTimeUpdated = millis();
 		blinds[i].commanded = 0;
+		blinds[i].linkQuality = LINK_QUALITY_INITIAL;
+		blinds[i].calPctLow = 0xFF;
+		blinds[i].travelRate = EEPROM.read(TRAVEL_RATE_ADDR + i*2) |
+			(word(EEPROM.read(TRAVEL_RATE_ADDR + i*2 + 1)) << 8);
+		blinds[i].bus = EEPROM.read(BUS_MAP_ADDR + i);
+		if (blinds[i].bus >= NUM_BUSES) {
+			blinds[i].bus = 0;
+		}
+
+		// Start from the cached position, the poller will confirm it
+		byte cached = EEPROM.read(POSITION_CACHE_ADDR + i);
+		blinds[i].savedPercentage = cached;
+		if (cached <= 100) {
+			blinds[i].curPercentage = cached;
+		}
+	}
+}
+
+// Store the positions of the blinds that have settled
+void savePositions() {
+	for(byte i=0; i<numBlinds; ++i) {
+		if (!blinds[i].positionVerified || blinds[i].commanded ||
+			blinds[i].curPercentage == blinds[i].savedPercentage ||
+			!differsBy(millis(), blinds[i].lastChangedTime, POSITION_SAVE_DELAY)) {
+			continue;
+		}
+		EEPROM.write(POSITION_CACHE_ADDR + i, blinds[i].curPercentage);
+		blinds[i].savedPercentage = blinds[i].curPercentage;
+	}
+}
+
+// Write the byte only if it has changed, to spare the EEPROM
+void updateEeprom(word addr, byte value) {
+	if (EEPROM.read(addr) != value) {
+		EEPROM.write(addr, value);
 	}
 }
 
 void saveBlindSettings() {
-	byte pos = 2;
+	byte pos = NUM_BLINDS_ADDR;
 	EEPROM.write(pos++, numBlinds);
 	for(byte i=0; i<numBlinds; ++i) {
 		EEPROM.write(pos++, blinds[i].addr1);
 		EEPROM.write(pos++, blinds[i].addr2);
 		EEPROM.write(pos++, blinds[i].addr3);
+		if (EEPROM.read(BUS_MAP_ADDR + i) != blinds[i].bus) {
+			EEPROM.write(BUS_MAP_ADDR + i, blinds[i].bus);
+		}
+	}
+	// The blinds might have been renumbered, forget the positions and the
+	// travel rates
+	for(byte i=0; i<MAX_BLINDS; ++i) {
+		if (EEPROM.read(POSITION_CACHE_ADDR + i) != 0xFF) {
+			EEPROM.write(POSITION_CACHE_ADDR + i, 0xFF);
+		}
+	}
+	for(byte i=0; i<MAX_BLINDS*2; ++i) {
+		if (EEPROM.read(TRAVEL_RATE_ADDR + i) != 0xFF) {
+			EEPROM.write(TRAVEL_RATE_ADDR + i, 0xFF);
+		}
+	}
+	// The scenes refer to the blinds by their numbers
+	for(byte n=0; n<SCENES; ++n) {
+		updateEeprom(SCENE_ADDR + n*SCENE_LEN, 0xFF);
 	}
 }
 
@@ -203,11 +523,25 @@ void initOled() {
 	oled.begin();
 	delay(50);
 	oled.setFont(SmallFont);
-	oled.clrscr();
-	oledIsOff = 0;
+	clearScreen();
+	oledPower = OLED_POWER_ON;
 	oled.on();
 }
 
+void wakeOled() {
+	if (!oled.isResponding()) {
+		// The controller has lost power or hung, start it from scratch
+		LOG_INFO(EV_OLED_RESET, LOG_NO_BLIND, 0);
+		initOled();
+		return;
+	}
+	oled.setBrightness(OLED_BRIGHTNESS);
+	if (oledPower == OLED_POWER_OFF) {
+		oled.on();
+	}
+	oledPower = OLED_POWER_ON;
+}
+
 void printPaddedHex(byte num) {
 	if (num < 16){
 		oled.print("0");
@@ -228,233 +562,740 @@ void printPaddedPercentage(byte num) {
 	}
 }
 
-// Print the current shutter status on OLED
-void printStatus() {
-	// Save the screen, disable it if nothing is happening.
-	if (differsBy(millis(), lastInterestingTime, 60000)) {
-		if (!oledIsOff) {
-			oled.off();
-			oledIsOff = 1;
-		}
+// Clear the screen and forget what was drawn on it
+void clearScreen() {
+	oled.setStartPage(0);
+	oled.clrscr();
+	for (byte i = 0; i < OLED_ROWS; ++i) {
+		oledRows[i].blind = OLED_ROW_EMPTY;
+		oledRows[i].percentage = 0;
+		oledRows[i].commandedPercent = 0;
+		oledRows[i].flags = 0;
+	}
+}
+
+void printBlindRow(byte i) {
+	// The wire address is obfuscated, deobfuscate it.
+	printPaddedHex(~blinds[i].addr3);
+	printPaddedHex(~blinds[i].addr2);
+	printPaddedHex(~blinds[i].addr1);
+
+	if (blinds[i].isOffline) {
+		oled.println(": offline   ");
+		return;
+	}
+
+	if (blinds[i].curPercentage == 255) {
+		oled.print(": N/A");
 	} else {
-		if (oledIsOff) {
-			initOled();
-		}
+		oled.print(": ");
+		printPaddedPercentage(100 - blinds[i].curPercentage);
 	}
 
-	oled.gotoXY(0, 1);
-	if (globalMode == DISCOVERY) {
-		oled.println("Status: discovery");
-		if (numBlinds>0) {
-			oled.println("Press BTN to finish");
-		}
-	} else if (globalMode == JOINING) {
-		oled.println("Status: zwave init");
+	if (blinds[i].commanded) {
+		oled.print(" -> ");
+		printPaddedPercentage(100 - blinds[i].commandedPercent);
+		oled.println();
 	} else {
-		oled.println("Status: working");
+		oled.println("        ");
 	}
-	for (int i = 0; i < numBlinds; ++i) {
-		// The wire address is obfuscated, deobfuscate it.
-		printPaddedHex(~blinds[i].addr3);
-		printPaddedHex(~blinds[i].addr2);
-		printPaddedHex(~blinds[i].addr1);
+}
 
-		if (blinds[i].isOffline) {
-			oled.println(": offline   ");
-			continue;
-		}
+// Redraw the screen row if its content differs from what's already there
+void printStatusRow(byte row, OledRow *wanted) {
+	OledRow *shown = &oledRows[(row + oled.startPage()) % OLED_ROWS];
+	if (shown->blind == wanted->blind && shown->flags == wanted->flags &&
+		shown->percentage == wanted->percentage &&
+		shown->commandedPercent == wanted->commandedPercent) {
+		return;
+	}
 
-		if (blinds[i].curPercentage == 255) {
-			oled.print(": N/A");
+	// Shorter lines don't overwrite the old text completely
+	if (shown->blind != wanted->blind || shown->flags != wanted->flags) {
+		oled.clearRow(row);
+	}
+	shown->blind = wanted->blind;
+	shown->percentage = wanted->percentage;
+	shown->commandedPercent = wanted->commandedPercent;
+	shown->flags = wanted->flags;
+
+	oled.gotoXY(0, row);
+	if (wanted->blind == OLED_ROW_HEADER) {
+		if (globalMode == DISCOVERY) {
+			oled.println("Status: discovery");
+		} else if (globalMode == JOINING) {
+			oled.println("Status: zwave init");
 		} else {
-			oled.print(": ");
-			printPaddedPercentage(100 - blinds[i].curPercentage);
+			oled.println("Status: working");
 		}
+	} else if (wanted->blind == OLED_ROW_HINT) {
+		oled.println("Press BTN to finish");
+	} else if (wanted->blind != OLED_ROW_EMPTY) {
+		printBlindRow(wanted->blind);
+	}
+}
 
-		if (blinds[i].commanded) {
-			oled.print(" -> ");
-			printPaddedPercentage(100 - blinds[i].commandedPercent);
-			oled.println();
-		} else {
-			oled.println("        ");
+// Print the current shutter status on OLED
+void printStatus() {
+	// Save the screen, dim and then disable it if nothing is happening.
+	if (differsBy(millis(), lastInterestingTime, OLED_OFF_TIMEOUT)) {
+		if (oledPower != OLED_POWER_OFF) {
+			oled.off();
+			oledPower = OLED_POWER_OFF;
+		}
+	} else if (differsBy(millis(), lastInterestingTime, OLED_DIM_TIMEOUT)) {
+		if (oledPower == OLED_POWER_ON) {
+			oled.setBrightness(OLED_DIM_BRIGHTNESS);
+			oledPower = OLED_POWER_DIM;
+		}
+	} else if (oledPower != OLED_POWER_ON) {
+		wakeOled();
+	}
+
+	byte headerRows = 1;
+	if (globalMode == DISCOVERY && numBlinds > 0) {
+		headerRows = 2;
+	}
+	byte listRows = OLED_ROWS - OLED_HEADER_ROW - headerRows;
+
+	if (numBlinds <= listRows) {
+		oledFirstBlind = 0;
+	} else if (oledPower != OLED_POWER_OFF &&
+		differsBy(millis(), oledLastScrollTime, OLED_SCROLL_INTERVAL)) {
+		// Too many blinds to fit, cycle through them one row at a time. The
+		// controller moves the picture up, so only the header and the rows
+		// that wrapped around from the top need to be redrawn.
+		oledLastScrollTime = millis();
+		oledFirstBlind = (oledFirstBlind + 1) % numBlinds;
+		oled.setStartPage(oled.startPage() + 1);
+	}
+
+	OledRow wanted;
+	for (byte row = 0; row < OLED_ROWS; ++row) {
+		wanted.blind = OLED_ROW_EMPTY;
+		wanted.percentage = 0;
+		wanted.commandedPercent = 0;
+		wanted.flags = 0;
+
+		if (row == OLED_HEADER_ROW) {
+			wanted.blind = OLED_ROW_HEADER;
+			wanted.percentage = globalMode;
+		} else if (row == OLED_HEADER_ROW + 1 && headerRows == 2) {
+			wanted.blind = OLED_ROW_HINT;
+		} else if (row >= OLED_HEADER_ROW + headerRows &&
+			row - OLED_HEADER_ROW - headerRows < numBlinds) {
+			byte i = (oledFirstBlind + row - OLED_HEADER_ROW - headerRows) % numBlinds;
+			wanted.blind = i;
+			if (blinds[i].isOffline) {
+				wanted.flags = OLED_ROW_OFFLINE;
+			} else {
+				wanted.percentage = blinds[i].curPercentage;
+				if (blinds[i].commanded) {
+					wanted.flags = OLED_ROW_COMMANDED;
+					wanted.commandedPercent = blinds[i].commandedPercent;
+				}
+			}
 		}
+		printStatusRow(row, &wanted);
 	}
 }
 
-void sendSomfyMessage(byte msgId, byte *payload, byte payloadLen) {
+// Build the frame in the wire format, returns its length. The frame buffer
+// must have room for MAX_FRAME_LEN bytes.
+byte encodeSomfyMessage(byte *frame, byte msgId, byte *payload, byte payloadLen) {
 	// Reserved byte is always 0xFF
 	// [msgId, 0xFF - len(payload) - 5, reserved] + payload + checksum
 	word checksum = 0;
-	blindsSerial.drain();
+	byte len = 0;
 
-	blindsSerial.write(msgId);
+	frame[len++] = msgId;
 	checksum += msgId;
 
-	blindsSerial.write(byte(0xFFu - payloadLen - 5));
+	frame[len++] = byte(0xFFu - payloadLen - 5);
 	checksum += byte(0xFFu - payloadLen - 5);
 
-	blindsSerial.write(byte(0xFFu));
+	frame[len++] = 0xFFu;
 	checksum += 0xFFu;
 
 	for(byte i=0; i<payloadLen; ++i) {
-		blindsSerial.write(payload[i]);
+		frame[len++] = payload[i];
 		checksum += payload[i];
 	}
 
-	blindsSerial.write(byte(checksum / 256));
-	blindsSerial.write(byte(checksum % 256));
+	frame[len++] = byte(checksum / 256);
+	frame[len++] = byte(checksum % 256);
+	return len;
+}
+
+// Put the frame into the send queue of the bus, the timer interrupt sends
+// it in the background
+void queueSomfyMessage(byte bus, byte msgId, byte *payload, byte payloadLen) {
+	byte frame[MAX_FRAME_LEN];
+	byte len = encodeSomfyMessage(frame, msgId, payload, payloadLen);
+	OddSoftSer *port = buses[bus];
+	pumpBus();
+	for(byte i=0; i<len; ++i) {
+		port->write(frame[i]);
+	}
+}
+
+void flushBuses() {
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		buses[b]->flush();
+	}
+}
+
+// Send the frame and wait until it has left
+void sendSomfyMessage(byte bus, byte msgId, byte *payload, byte payloadLen) {
+	queueSomfyMessage(bus, msgId, payload, payloadLen);
+	buses[bus]->flush();
+}
+
+// Drop everything that was received, including the partially parsed frames
+void drainBus() {
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		buses[b]->drain();
+		frameParserReset(&busParsers[b]);
+	}
+}
+
+// The receive error counters of the bus, for the bus health statistics
+void readBusErrors(byte bus, BusErrors *errors) {
+	errors->checksum = busParsers[bus].checksumErrors;
+	errors->parity = buses[bus]->parityErrors();
+	errors->framing = buses[bus]->framingErrors();
 }
 
-// Read the next byte from the serial, obeying the total time budget
-bool readWithTimeout(byte *output, word *timeBudget) {
-	while(!blindsSerial.available()) {
-		if (*timeBudget == 0) {
-			return false;
+byte findBlind(byte addr1, byte addr2, byte addr3) {
+	for(byte i=0; i<numBlinds; ++i) {
+		if (blinds[i].addr1 == addr1 && blinds[i].addr2 == addr2 &&
+			blinds[i].addr3 == addr3) {
+			return i;
 		}
-		word curDelay = min(*timeBudget, 50);
-		*timeBudget -= curDelay;
-		delay(curDelay);
 	}
+	return 0xFF;
+}
 
-	*output = blindsSerial.read();
-#ifdef DEBUG_PRINT
-	Serial.print(*output, 16);
-	Serial.print(" ");
-#endif
-	return true;
+// Widen the tick calibration of the blind with a new reply
+void calibrateTicks(byte i, byte pct, word ticks) {
+	Blinds *b = &blinds[i];
+	if (b->calPctLow == 0xFF) {
+		b->calPctLow = b->calPctHigh = pct;
+		b->calTicksLow = b->calTicksHigh = ticks;
+	} else if (pct < b->calPctLow) {
+		b->calPctLow = pct;
+		b->calTicksLow = ticks;
+	} else if (pct > b->calPctHigh) {
+		b->calPctHigh = pct;
+		b->calTicksHigh = ticks;
+	}
 }
 
-bool readMessage(byte expectedType, byte *resultBuf, byte resultLen) {
-	// We allocate 30 ms for the message reading to avoid ZWave radio timeouts
-	word timeBudget = 30;
+// The position in 0.1% steps, from the ticks once they are calibrated. The
+// percentage that the motor reports is rounded down, the ticks are not.
+word finePosition(byte i) {
+	Blinds *b = &blinds[i];
+	if (b->calPctLow == 0xFF || b->calPctHigh - b->calPctLow < TICKS_CAL_MIN_SPAN ||
+		b->calTicksHigh == b->calTicksLow) {
+		return word(b->curPercentage) * 10;
+	}
+	// The ticks can go either way, depending on how the motor is mounted
+	long pos = long(b->ticks) - long(b->calTicksLow);
+	pos = pos * (b->calPctHigh - b->calPctLow) * 10 / (long(b->calTicksHigh) - long(b->calTicksLow));
+	pos += long(b->calPctLow) * 10;
+	if (pos < 0) {
+		return 0;
+	}
+	if (pos > 1000) {
+		return 1000;
+	}
+	return word(pos);
+}
 
-	// Try to read the next Somfy message. We want to start at the beginning
-	// of the message, so we're looking for the msgId byte.
-	while(timeBudget > 0) {
-		byte msgId;
-		if (readWithTimeout(&msgId, &timeBudget) && msgId == expectedType) {
-			break;
+// A position reply from the blind, to us or to another controller
+void updateBlindPosition(byte i, byte newPos, word ticks) {
+	// The position before the first motion of a commanded move
+	word startPos = 0;
+	bool timeMove = blinds[i].commandSent && !blinds[i].moveStartTime &&
+		blinds[i].positionVerified;
+	if (timeMove) {
+		startPos = finePosition(i);
+	}
+	blinds[i].lastTimeUpdated = millis();
+	calibrateTicks(i, newPos, ticks);
+	if (!blinds[i].positionVerified) {
+		blinds[i].positionVerified = 1;
+		blinds[i].ticks = ticks;
+		if (blinds[i].curPercentage != newPos) {
+			// The cached position was stale, correct the controller
+			reportBlind(i);
 		}
 	}
-	word checkSum = expectedType;
+	if (blinds[i].isOffline) {
+		blinds[i].isOffline = false;
+		busChanged = 1;
+	}
 
-	// Now read the length byte
-	byte lenByte;
-	if (!readWithTimeout(&lenByte, &timeBudget)) {
-		return false;
+	if (blinds[i].curPercentage != newPos) {
+		// The shades are moving, so the command was received
+		if (blinds[i].commandSent) {
+			blinds[i].commandAcked = 1;
+		}
+		LOG_DEBUG(EV_NEW_POSITION, i, newPos);
+		blinds[i].curPercentage = newPos;
+		busChanged = 1;
+	}
+	// Any tick delta is a motion, long before the percentage changes. Update
+	// the jamming detection timestamps.
+	if (blinds[i].ticks != ticks) {
+		if (blinds[i].commandSent) {
+			blinds[i].commandAcked = 1;
+		}
+		if (timeMove) {
+			blinds[i].moveStartPos = startPos;
+			blinds[i].moveStartTime = millis();
+		}
+		blinds[i].ticks = ticks;
+		blinds[i].ticksStable = 0;
+		blinds[i].lastChangedTime = millis();
+		blinds[i].unjamTryCount = 0;
+		blinds[i].lastUnjamTryTime = 0;
+	} else if (blinds[i].ticksStable < 0xFF) {
+		blinds[i].ticksStable++;
 	}
-	checkSum += lenByte;
-	// The packet is: [msgId, 0xFF - payloadLen - 4, payload..., checksum1, checksum2]
-	byte payloadLen = 0xFF - lenByte - 4; // Deobfuscate it.
+}
 
-	if (payloadLen > resultLen) {
-		return false;
+// The blind has reached the commanded position, or it has stopped near it
+// after moving
+bool hasArrived(byte i) {
+	word target = word(blinds[i].commandedPercent) * 10;
+	word pos = finePosition(i);
+	word distance = pos > target ? pos - target : target - pos;
+	if (distance <= ARRIVED_TOLERANCE) {
+		return true;
 	}
+	return blinds[i].commandAcked && blinds[i].ticksStable &&
+		distance <= STOPPED_TOLERANCE;
+}
 
-	for(byte i=0; i<payloadLen; ++i) {
-		byte payload;
-		if (!readWithTimeout(&payload, &timeBudget)) {
-			return false;
+// The finished move is timed from the first reply that showed the motion to
+// the last one, both lag the motor by up to a poll interval
+void measureTravelRate(byte i) {
+	Blinds *b = &blinds[i];
+	if (!b->moveStartTime) {
+		return;
+	}
+	dword elapsed = b->lastChangedTime - b->moveStartTime;
+	word pos = finePosition(i);
+	word distance = pos > b->moveStartPos ? pos - b->moveStartPos : b->moveStartPos - pos;
+	b->moveStartTime = 0;
+	if (distance < TRAVEL_MIN_DISTANCE || elapsed < 1000) {
+		return;
+	}
+	dword rate = dword(distance) * 10000 / elapsed;
+	if (rate >= TRAVEL_RATE_UNKNOWN) {
+		rate = TRAVEL_RATE_UNKNOWN - 1;
+	}
+	if (b->travelRate != TRAVEL_RATE_UNKNOWN) {
+		// Smooth out the poll timing
+		rate = (dword(b->travelRate) * 3 + rate) / 4;
+	}
+	if (rate == 0 || rate == b->travelRate) {
+		return;
+	}
+	b->travelRate = word(rate);
+	word stored = EEPROM.read(TRAVEL_RATE_ADDR + i*2) |
+		(word(EEPROM.read(TRAVEL_RATE_ADDR + i*2 + 1)) << 8);
+	word drift = stored > rate ? stored - rate : rate - stored;
+	if (stored != TRAVEL_RATE_UNKNOWN && drift <= stored / TRAVEL_RATE_SAVE_SHARE) {
+		return;
+	}
+	updateEeprom(TRAVEL_RATE_ADDR + i*2, byte(rate));
+	updateEeprom(TRAVEL_RATE_ADDR + i*2 + 1, byte(rate >> 8));
+}
+
+// The expected time for the blind to reach the commanded position, in ms
+dword travelTime(byte i) {
+	word target = word(blinds[i].commandedPercent) * 10;
+	word pos = finePosition(i);
+	word distance = pos > target ? pos - target : target - pos;
+	word rate = blinds[i].travelRate;
+	if (rate == TRAVEL_RATE_UNKNOWN) {
+		rate = TRAVEL_RATE_DEFAULT;
+	}
+	return dword(distance) * 10000 / rate;
+}
+
+// Hold back the faster blinds of a group move, so that all of them arrive
+// together with the slowest one. The blinds with an unconfirmed position
+// and the ones already in place aren't timed, they are sent right away.
+void planGroupMove() {
+	dword now = millis();
+	dword longest = 0, shortest = 0xFFFFFFFFu;
+	groupRemaining = groupArrivals = 0;
+	for(byte i=0; i<numBlinds; ++i) {
+		if (!blinds[i].inGroup) {
+			continue;
 		}
-		resultBuf[i] = payload;
-		checkSum += payload;
+		if (!blinds[i].positionVerified || hasArrived(i)) {
+			blinds[i].inGroup = 0;
+			continue;
+		}
+		dword t = travelTime(i);
+		longest = max(longest, t);
+		shortest = min(shortest, t);
+		groupRemaining++;
+	}
+	if (!groupRemaining) {
+		return;
 	}
 
-	// Now read the checksum and compare it to the computed
-	byte checksum1, checksum2;
-	if (!readWithTimeout(&checksum1, &timeBudget) ||
-			!readWithTimeout(&checksum2, &timeBudget)) {
-		return false;
+	dword firstArrival = 0xFFFFFFFFu, lastArrival = 0;
+	for(byte i=0; i<numBlinds; ++i) {
+		if (!blinds[i].inGroup) {
+			continue;
+		}
+		dword t = travelTime(i);
+		dword delay = min(dword(GROUP_MAX_DELAY), longest - t);
+		blinds[i].commandedTime = now + delay;
+		firstArrival = min(firstArrival, delay + t);
+		lastArrival = max(lastArrival, delay + t);
+	}
+	groupUnplannedSpread = word(min(dword(0xFFFF), longest - shortest));
+	groupPlannedSpread = word(min(dword(0xFFFF), lastArrival - firstArrival));
+	LOG_INFO(EV_GROUP_PLANNED, groupRemaining, groupPlannedSpread);
+}
+
+// The blind is done with the group move, by arriving or otherwise
+void leaveGroup(byte i, bool arrived) {
+	if (!blinds[i].inGroup) {
+		return;
+	}
+	blinds[i].inGroup = 0;
+	if (arrived) {
+		dword at = blinds[i].lastChangedTime;
+		if (!groupArrivals || isBefore(at, groupFirstArrival)) {
+			groupFirstArrival = at;
+		}
+		if (!groupArrivals || isBefore(groupLastArrival, at)) {
+			groupLastArrival = at;
+		}
+		groupArrivals++;
 	}
+	if (--groupRemaining == 0 && groupArrivals) {
+		groupActualSpread = word(min(dword(0xFFFF), groupLastArrival - groupFirstArrival));
+		LOG_INFO(EV_GROUP_ARRIVED, groupArrivals, groupActualSpread);
+	}
+}
 
-	bool checksumOk = (checksum1 == checkSum / 256) && (checksum2 == checkSum % 256);
-#ifdef DEBUG_PRINT
-	if (checksumOk) {
-		Serial.println(" - ok");
-	} else {
-		Serial.println(" - failed");
+// Handle a complete frame from the bus, whoever it was meant for. The payload
+// starts with the reserved byte, followed by the source and the destination
+// addresses.
+void dispatchFrame(byte bus, FrameParser *frame) {
+	byte *payload = frame->payload;
+	if (frame->payloadLen < 4) {
+		return;
+	}
+	byte i = findBlind(payload[1], payload[2], payload[3]);
+
+	switch(frame->msgId) {
+	case HERE_IS_MOTOR:
+		// The first 3 bytes of payload is the motor address
+		if (globalMode == DISCOVERY) {
+			initMotor(payload[1], payload[2], payload[3], bus);
+		} else if (onlineDiscovery && i == 0xFF) {
+			appendMotor(payload[1], payload[2], payload[3], bus);
+		}
+		break;
+
+	case HERE_IS_POSITION:
+		if (i != 0xFF && frame->payloadLen >= 10) {
+			updateBlindPosition(i, 0xFF - payload[9], payload[7] + word(payload[8]) * 256);
+			if (busPolls[bus].blind == i) {
+				busPolls[bus].replied = 1;
+			}
+		}
+		break;
+
+	case MOVE_MOTOR_TO_POS:
+	case STOP_MOTOR:
+		if (frame->payloadLen < 7 ||
+			(payload[1] == 0x80u && payload[2] == 0x80u && payload[3] == 0x80u)) {
+			break; // Our own command
+		}
+		// Another controller is moving the blind, watch it closely
+		i = findBlind(payload[4], payload[5], payload[6]);
+		if (i != 0xFF) {
+			lastInterestingTime = millis();
+			busChanged = 1;
+		}
+		break;
+	}
+}
+
+// Feed a byte received from the bus to its frame parser
+void feedBusByte(byte bus, byte b) {
+	FrameParser *parser = &busParsers[bus];
+	lastBusByteTime[bus] = millis();
+	if (parser->state == FRAME_WAIT_ID) {
+		busFrameStartTime[bus] = lastBusByteTime[bus];
 	}
+#ifdef DEBUG_PRINT
+	Serial.print(b, 16);
+	Serial.print(" ");
 #endif
-	return checksumOk;
+	if (frameParserFeed(parser, b)) {
+		dispatchFrame(bus, parser);
+	}
+}
+
+// Process everything that has been received so far
+void pumpBus() {
+	for(byte bus=0; bus<NUM_BUSES; ++bus) {
+		while(buses[bus]->available()) {
+			feedBusByte(bus, buses[bus]->read());
+		}
+		// All the bytes that were sent have arrived by now, so a long silence
+		// means that the rest of the frame is lost.
+		if (busParsers[bus].state != FRAME_WAIT_ID &&
+			differsBy(millis(), lastBusByteTime[bus], FRAME_GAP_TIMEOUT)) {
+			frameParserReset(&busParsers[bus]);
+		}
+	}
+	softSerialSleep();
 }
 
 void runDiscoveryAttempt() {
 // DISCOVER_ALL
 	byte discoverAllPayload[] = {0x80u, 0x80u, 0x80u, 00, 00, 00};
-	byte resultBuf[20];
 
-	blindsSerial.drain();
-	sendSomfyMessage(DISCOVER_ALL_MOTORS, discoverAllPayload, 6);
-	delay(100); // We have a nice buffer in the serial library, use it!
+	drainBus();
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		queueSomfyMessage(b, DISCOVER_ALL_MOTORS, discoverAllPayload, 6);
+	}
+	flushBuses();
+	// We have a nice buffer in the serial library, use it! The HERE_IS_MOTOR
+	// replies are handled by dispatchFrame().
+	waitDiscoveryReplies();
+}
+
+// Listen for the whole reply window of a discovery broadcast, and then
+// until the replies that are still arriving are over
+void waitDiscoveryReplies() {
+	serviceDelay(DISCOVERY_REPLY_WINDOW);
+	waitBusQuiet(MOTOR_REPLY_DELAY);
+}
 
-	// Listen for the HERE_IS_MOTOR blinds reply
-	while(blindsSerial.available()) {
-		if (readMessage(HERE_IS_MOTOR, resultBuf, 16)) {
-			// The first 3 bytes of payload is the motor address
-			initMotor(resultBuf[1], resultBuf[2], resultBuf[3]);
-		}
+// Double the delay until the next probe of an offline blind. The jitter
+// keeps the probes of several dead motors from bunching up.
+void backoffProbe(byte i) {
+	dword nextDelay = dword(blinds[i].probeDelay) * 2;
+	if (nextDelay > OFFLINE_PROBE_MAX_DELAY) {
+		nextDelay = OFFLINE_PROBE_MAX_DELAY;
 	}
+	nextDelay -= millis() % (nextDelay / 4);
+	blinds[i].lastProbeTime = millis();
+	blinds[i].probeDelay = nextDelay;
 }
 
-bool readMotorStates() {
-	bool changed = false;
+// Fold the outcome of a status request into the link quality average
+void updateLinkQuality(byte i, bool replied) {
+	int target = replied ? 255 : 0;
+	int quality = blinds[i].linkQuality;
+	quality += (target - quality) >> LINK_QUALITY_SHIFT;
+	if (replied && quality < 255 && quality == blinds[i].linkQuality) {
+		quality++; // The shift rounds down, don't get stuck just below 255
+	}
+	blinds[i].linkQuality = byte(quality);
+}
+
+// The number of status requests needed to get a reply from the motor with
+// reasonable confidence. A clean link gets a single request.
+byte statusAttempts(byte i) {
+	byte quality = blinds[i].linkQuality;
+	if (quality >= 243) { // 95%
+		return 1;
+	}
+	if (quality >= 204) { // 80%
+		return 2;
+	}
+	if (quality >= 128) { // 50%
+		return 3;
+	}
+	return MAX_STATUS_ATTEMPTS;
+}
+
+// The number of copies of a command frame. The motors don't acknowledge the
+// commands, so the status replies are the only measure of the link.
+byte commandCopies(byte i) {
+	return min(statusAttempts(i), byte(MAX_COMMAND_COPIES));
+}
+
+// Queue the status request of the current attempt on the bus
+void sendStatusRequest(byte bus) {
 	// GET_MOTOR_STATUS payload buf
 	byte getMotorStatus[] = {0x80u, 0x80u, 0x80u, 00, 00, 00};
-	byte resultBuf[24];
+	BusPoll *poll = &busPolls[bus];
+	byte i = poll->blind;
+	getMotorStatus[3] = blinds[i].addr1;
+	getMotorStatus[4] = blinds[i].addr2;
+	getMotorStatus[5] = blinds[i].addr3;
+
+	BusErrors errors;
+	readBusErrors(bus, &errors);
+	busHealthRequest(i, poll->attempt > 0, &errors);
+	poll->replied = 0;
+	queueSomfyMessage(bus, REPORT_MOTOR_STATUS, getMotorStatus, 6);
+	poll->sentTime = millis();
+}
 
-	for(byte i=0; i<numBlinds; ++i) {
+// Start polling the next blind on the bus, returns false if there are no
+// more blinds to poll in this pass. If the poll doesn't fit into the loop
+// budget, only the commanded blinds are polled: their acks and arrivals
+// can't wait. The rest of the pass is left for the next loop.
+bool startNextPoll(byte bus, bool fits) {
+	BusPoll *poll = &busPolls[bus];
+	while(poll->next < numBlinds) {
+		byte i = poll->next++;
+		if (blinds[i].bus != bus) {
+			continue;
+		}
+		if (!fits && !blinds[i].commanded) {
+			if (poll->resume == NO_POLL) {
+				poll->resume = i;
+			}
+			pollPassPending = 1;
+			continue;
+		}
 		// Interrogate each motor, use retries to compensate for bad network
-		getMotorStatus[3] = blinds[i].addr1;
-		getMotorStatus[4] = blinds[i].addr2;
-		getMotorStatus[5] = blinds[i].addr3;
-
-		for(int k=0; k<5; ++k) {
-			sendSomfyMessage(REPORT_MOTOR_STATUS, getMotorStatus, 6);
-			delay(80);
-			if (readMessage(HERE_IS_POSITION, resultBuf, 16)) {
-				byte newPos = 0xFF - resultBuf[9];
-				blinds[i].lastTimeUpdated = millis();
-				if (blinds[i].isOffline) {
-					blinds[i].isOffline = false;
-					changed = true;
-				}
+		byte attempts = statusAttempts(i);
+		if (blinds[i].isOffline) {
+			// Don't waste the bus time on dead motors, probe them once in a while
+			if (!differsBy(millis(), blinds[i].lastProbeTime, blinds[i].probeDelay)) {
+				continue;
+			}
+			attempts = 1;
+			backoffProbe(i);
+		}
+		poll->blind = i;
+		poll->attempt = 0;
+		poll->attempts = attempts;
+		sendStatusRequest(bus);
+		return true;
+	}
+	poll->blind = NO_POLL;
+	return false;
+}
 
-				if (blinds[i].curPercentage != newPos) {
-					// The shades are moving, so the command was received
-					if (blinds[i].commandSent) {
-						blinds[i].commandAcked = 1;
-					}
-					Serial.print("New pos for blind ");
-					Serial.print(i); Serial.print(" is ");
-					Serial.println(newPos);
-					blinds[i].curPercentage = newPos;
-					changed = true;
-				}
-				// Update the jamming detection timestamps
-				if (blinds[i].lastPosition != newPos) {
-					blinds[i].lastPosition = newPos;
-					blinds[i].lastChangedTime = millis();
-					blinds[i].unjamTryCount = 0;
-					blinds[i].lastUnjamTryTime = 0;
+void endPoll(byte bus) {
+	BusErrors errors;
+	readBusErrors(bus, &errors);
+	busHealthEnd(busPolls[bus].blind, &errors);
+	busPolls[bus].blind = NO_POLL;
+}
+
+// Move the polling of the bus forward, returns false once all its blinds
+// have been polled
+bool servicePoll(byte bus) {
+	BusPoll *poll = &busPolls[bus];
+	if (poll->blind == NO_POLL) {
+		return false;
+	}
+	byte i = poll->blind;
+	if (buses[bus]->sending()) {
+		// The reply delay starts when the request has left
+		poll->sentTime = millis();
+		return true;
+	}
+	if (poll->replied) {
+		// dispatchFrame() has already updated the blind
+		busHealthReply(i, busFrameStartTime[bus] - poll->sentTime);
+		updateLinkQuality(i, true);
+		endPoll(bus);
+		return startNextPoll(bus, budgetAllows(POLL_COST));
+	}
+
+	// A frame that has started gets the time its length needs at 4800 baud
+	byte missing = frameParserMissing(&busParsers[bus]);
+	if (missing) {
+		if (!differsBy(millis(), lastBusByteTime[bus], FRAME_TIME(missing) + FRAME_GAP_TIMEOUT)) {
+			return true;
+		}
+	} else if (!differsBy(millis(), poll->sentTime, MOTOR_REPLY_TIMEOUT)) {
+		return true;
+	}
+
+	updateLinkQuality(i, false);
+	poll->attempt++;
+	if (poll->attempt < poll->attempts) {
+		sendStatusRequest(bus);
+		return true;
+	}
+	endPoll(bus);
+	return startNextPoll(bus, budgetAllows(POLL_COST));
+}
+
+// Poll all the blinds. Each bus has a request in flight to one of its
+// blinds, so the pass takes as long as the busiest bus needs. A pass that
+// doesn't fit into the loop budget is split, each loop polls at least one
+// blind on each bus.
+bool readMotorStates() {
+	bool changed = false;
+	byte bus;
+	pollPassPending = 0;
+	for(bus=0; bus<NUM_BUSES; ++bus) {
+		BusPoll *poll = &busPolls[bus];
+		poll->next = poll->resume == NO_POLL ? 0 : poll->resume;
+		poll->resume = NO_POLL;
+		startNextPoll(bus, true);
+	}
+
+	while(true) {
+		watchdogService();
+		if (serviceStopLane()) {
+			// The stop preempts the polling, it will be resumed on the next pass.
+			// A wait cut short by the stop says nothing about the link.
+			for(bus=0; bus<NUM_BUSES; ++bus) {
+				if (busPolls[bus].blind != NO_POLL) {
+					endPoll(bus);
 				}
-				break;
 			}
+			return true;
+		}
+		pumpBus();
+		buttonService();
+		bool polling = false;
+		for(bus=0; bus<NUM_BUSES; ++bus) {
+			if (servicePoll(bus)) {
+				polling = true;
+			}
+		}
+		if (!polling) {
+			break;
 		}
+		delay(STOP_POLL_INTERVAL);
+	}
 
-		// Check for timeouts
+	// Check for timeouts
+	for(byte i=0; i<numBlinds; ++i) {
 		if (!blinds[i].isOffline &&
 			differsBy(millis(), blinds[i].lastTimeUpdated, OFFLINE_TIMEOUT)) {
 
 			changed = true;
-			Serial.print("Shade "); Serial.print(i);
-			Serial.println(" is offline");
+			LOG_INFO(EV_OFFLINE, i, 0);
 			blinds[i].isOffline = true;
+			blinds[i].lastProbeTime = millis();
+			blinds[i].probeDelay = OFFLINE_PROBE_MIN_DELAY;
 		}
 	}
+	if (busChanged) {
+		busChanged = 0;
+		changed = true;
+	}
 	return changed;
 }
 
-void initMotor(byte addr1, byte addr2, byte addr3) {
+void initMotor(byte addr1, byte addr2, byte addr3, byte bus) {
 	if (numBlinds == MAX_BLINDS) {
 		return;
 	}
@@ -472,11 +1313,7 @@ void initMotor(byte addr1, byte addr2, byte addr3) {
 			insertPos = i;
 		}
 	}
-	Serial.print("Discovered new motor: ");
-	Serial.print(addr3, HEX); Serial.print(" ");
-	Serial.print(addr2, HEX); Serial.print(" ");
-	Serial.print(addr1, HEX); Serial.print(" ");
-	Serial.println();
+	LOG_INFO(EV_DISCOVERED, addr3, word(addr2) << 8 | addr1);
 
 	// Insert the motor into the correct position. First shift existing blinds
 	// down if needed.
@@ -487,39 +1324,136 @@ void initMotor(byte addr1, byte addr2, byte addr3) {
 	blinds[insertPos].addr1 = addr1;
 	blinds[insertPos].addr2 = addr2;
 	blinds[insertPos].addr3 = addr3;
+	blinds[insertPos].bus = bus;
 	blinds[insertPos].curPercentage = 255;
 	blinds[insertPos].lastTimeUpdated = millis();
 	blinds[insertPos].isOffline = false;
 	blinds[insertPos].commanded = 0;
+	blinds[insertPos].linkQuality = LINK_QUALITY_INITIAL;
+	blinds[insertPos].positionVerified = 0;
+	blinds[insertPos].ticksStable = 0;
+	blinds[insertPos].calPctLow = 0xFF;
+	blinds[insertPos].travelRate = TRAVEL_RATE_UNKNOWN;
 	numBlinds++;
 
-	oled.clrscr();
+	clearScreen();
 	printStatus();
 }
 
-// Check if we want a reset
-void checkResetOrInclude() {
-	dword start = millis();
-	while(millis() - start < 10000) {
-		if (digitalRead(BTN_PIN) != LOW) {
-			break;
+// Add a motor found by the online discovery after the known ones, so that
+// the blinds keep their numbers, channels and stored data
+void appendMotor(byte addr1, byte addr2, byte addr3, byte bus) {
+	if (numBlinds == MAX_BLINDS) {
+		return;
+	}
+	byte i = numBlinds;
+	LOG_INFO(EV_DISCOVERED, addr3, word(addr2) << 8 | addr1);
+	my_memzero(&blinds[i], sizeof(Blinds));
+	blinds[i].addr1 = addr1;
+	blinds[i].addr2 = addr2;
+	blinds[i].addr3 = addr3;
+	blinds[i].bus = bus;
+	blinds[i].curPercentage = 255;
+	blinds[i].lastTimeUpdated = millis();
+	blinds[i].linkQuality = LINK_QUALITY_INITIAL;
+	blinds[i].calPctLow = 0xFF;
+	blinds[i].savedPercentage = 0xFF;
+	blinds[i].travelRate = TRAVEL_RATE_UNKNOWN;
+	numBlinds++;
+	onlineDiscoveryAdded++;
+
+	updateEeprom(BLINDS_ADDR + i*3, addr1);
+	updateEeprom(BLINDS_ADDR + i*3 + 1, addr2);
+	updateEeprom(BLINDS_ADDR + i*3 + 2, addr3);
+	updateEeprom(BUS_MAP_ADDR + i, bus);
+	updateEeprom(POSITION_CACHE_ADDR + i, 0xFF);
+	updateEeprom(TRAVEL_RATE_ADDR + i*2, 0xFF);
+	updateEeprom(TRAVEL_RATE_ADDR + i*2 + 1, 0xFF);
+	updateEeprom(NUM_BLINDS_ADDR, numBlinds);
+
+	// Poll the new blind soon
+	lastTimeRead = 0;
+	busChanged = 1;
+}
+
+void startOnlineDiscovery() {
+	if (globalMode != OPERATION || onlineDiscovery) {
+		return;
+	}
+	LOG_INFO(EV_ONLINE_DISCOVERY, 0, 1);
+	onlineDiscovery = 1;
+	onlineDiscoveryAdded = 0;
+	onlineDiscoveryStarted = millis();
+	lastDiscoveryTime = 0;
+}
+
+// Send a discovery broadcast if it's time, called when there are no commands
+// to send. The stop lane and the bus are serviced while the replies arrive.
+void serviceOnlineDiscovery() {
+	if (!onlineDiscovery) {
+		return;
+	}
+	if (numBlinds == MAX_BLINDS ||
+		differsBy(millis(), onlineDiscoveryStarted, ONLINE_DISCOVERY_TIME)) {
+		onlineDiscovery = 0;
+		LOG_INFO(EV_ONLINE_DISCOVERY, onlineDiscoveryAdded, 0);
+		if (onlineDiscoveryAdded) {
+			// Z-Uno takes the channel list at the startup, so reboot to
+			// add the channels of the new blinds after the existing ones,
+			// like after the first discovery. The hub has to re-interview
+			// the board to learn about them. Nothing is commanded now, keep
+			// the positions that haven't been saved yet.
+			for(byte i=0; i<numBlinds; ++i) {
+				if (blinds[i].positionVerified) {
+					updateEeprom(POSITION_CACHE_ADDR + i, blinds[i].curPercentage);
+				}
+			}
+			flushLog();
+			zunoReboot();
 		}
-		delay(100);
+		return;
+	}
+	if (lastDiscoveryTime && !differsBy(millis(), lastDiscoveryTime, ONLINE_DISCOVERY_INTERVAL)) {
+		return;
+	}
+	byte discoverAllPayload[] = {0x80u, 0x80u, 0x80u, 00, 00, 00};
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		queueSomfyMessage(b, DISCOVER_ALL_MOTORS, discoverAllPayload, 6);
 	}
+	flushBuses();
+	waitDiscoveryReplies();
+	lastDiscoveryTime = millis();
+}
+
+// Check if we want a reset
+void startLearn() {
+	clearScreen();
+	oled.println("Learning");
+	zunoStartLearn(20, 0);
+	clearScreen();
+}
 
-	DWORD diff = millis() - start;
-	if (diff > 2000 && diff < 6000) {
-		oled.clrscr();
-		oled.println("Learning");
-		zunoStartLearn(20, 0);
-		oled.clrscr();
+// Act on the button gestures: a 2-6 s hold or a triple click starts the
+// learn mode (the exclusion if the board is in a network), a double click
+// runs the button scene, four clicks start the online discovery and an 8 s
+// hold resets the board
+void checkButton() {
+	word arg;
+	byte gesture = buttonGesture(&arg);
+	if (gesture == GESTURE_HOLD && arg > BTN_LEARN_MIN && arg < BTN_LEARN_MAX) {
+		startLearn();
+	} else if (gesture == GESTURE_CLICKS && arg == 3) {
+		startLearn();
+	} else if (gesture == GESTURE_CLICKS && arg == 2 && globalMode == OPERATION) {
+		pendingScene = BTN_SCENE;
+	} else if (gesture == GESTURE_CLICKS && arg == 4) {
+		startOnlineDiscovery();
 	}
 
-	if (diff > 8000) {
-		// The button was held for 10 seconds, reset the mode to discovery.
-		// Will still need to exclude the board.
+	if (gesture == GESTURE_LONG_HOLD) {
+		// Reset the mode to discovery. Will still need to exclude the board.
 		setMode(DISCOVERY);
-		oled.clrscr();
+		clearScreen();
 		oled.println("Device is reset");
 		oled.println("Triple-click to exclude");
 		delay(5000);
@@ -527,17 +1461,16 @@ void checkResetOrInclude() {
 	}
 }
 
-void sendReportThrottled(bool important) {
-	if (important) {
-		Serial.println("Sending an important report");
-		lastReportSent = millis();    
-		zunoSendUncolicitedReport(1);
-    for(int i = 0; i < numBlinds; i++) {
-      zunoSendUncolicitedReport(i+2);
-    }
-		return;
-	}
+// The blind has reached a new state, report it along with the group channel.
+// The reports go through the shaper, so a series of blinds finishing their
+// moves is merged into a few reports.
+void reportBlind(byte i) {
+	LOG_DEBUG(EV_REPORT_IMPORTANT, i, 0);
+	reportQueue(1);
+	reportQueue(i + 2);
+}
 
+void sendReportThrottled() {
 	// Send the report
 	dword diff;
 	if (!differsBy(lastInterestingTime, millis(), 30000)) {
@@ -547,11 +1480,9 @@ void sendReportThrottled(bool important) {
 	}
 
 	if (differsBy(lastReportSent, millis(), diff)) {
-		Serial.println("Sending a routine report");
-		zunoSendUncolicitedReport(1);
-    for(int i = 0; i < numBlinds; i++) {
-      zunoSendUncolicitedReport(i+2);
-    }
+		LOG_DEBUG(EV_REPORT_ROUTINE, LOG_NO_BLIND, 0);
+		publishBusHealth(numBlinds);
+		reportQueueRoutine(numBlinds + 1);
 		lastReportSent = millis();
 	}
 }
@@ -574,24 +1505,40 @@ void updateZwaveValues() {
 }
 
 void checkZwaveSetters() {
+	word scene = zunoLoadCFGParam(SCENE_STORE_PARAM);
+	if (scene) {
+		zunoSaveCFGParam(SCENE_STORE_PARAM, 0);
+		storeScene(scene);
+	}
+	if (zunoLoadCFGParam(DISCOVERY_PARAM)) {
+		zunoSaveCFGParam(DISCOVERY_PARAM, 0);
+		startOnlineDiscovery();
+	}
+	scene = zunoLoadCFGParam(SCENE_RUN_PARAM);
+	if (scene) {
+		zunoSaveCFGParam(SCENE_RUN_PARAM, 0);
+		if (scene <= SCENES) {
+			pendingScene = scene;
+		}
+	}
+
 	if (zunoIsChannelUpdated(1)) {
-		Serial.print("Received command for all blinds ");
-		Serial.print("to move to "); Serial.println(g_channels_data[0].bParam);
-		byte anyCommanded = false;
+		LOG_INFO(EV_COMMAND_ALL, LOG_NO_BLIND, g_channels_data[0].bParam);
 		for(byte i=0; i<numBlinds; ++i) {
 			int cmd = 99 - min(99, g_channels_data[0].bParam);
+			// The previous group move isn't timed any more
+			blinds[i].inGroup = 0;
 			if (blinds[i].commandedPercent == cmd && blinds[i].commanded) {
 				continue;
 			}
-			anyCommanded = true;
 			blinds[i].commandedPercent = cmd;
 			blinds[i].commanded = 1;
 			blinds[i].commandedTime = millis();
 			blinds[i].commandSent = blinds[i].commandAcked = 0;
+			blinds[i].moveStartTime = 0;
+			blinds[i].inGroup = 1;
 		}
-		if (anyCommanded) {
-			Serial.println("Command was sent to at least one motor");
-		}
+		planGroupMove();
 	}
 
 	// Try to check getters/setters for individual channels
@@ -602,12 +1549,13 @@ void checkZwaveSetters() {
 				continue;
 			}
 
-			Serial.print("Received direct command for blinds "); Serial.print(i);
-			Serial.print(" to "); Serial.println(g_channels_data[i+1].bParam);
+			LOG_INFO(EV_COMMAND_DIRECT, i, g_channels_data[i+1].bParam);
+			leaveGroup(i, false);
 			blinds[i].commandedPercent = cmd;
 			blinds[i].commanded = 1;
 			blinds[i].commandedTime = millis();
 			blinds[i].commandSent = blinds[i].commandAcked = 0;
+			blinds[i].moveStartTime = 0;
 			return;
 		}
 	}
@@ -617,10 +1565,13 @@ void detectJams() {
 	dword now = millis();
 
 	for(byte i=0; i<numBlinds; ++i) {
-		if (!blinds[i].commanded) {
+		if (!blinds[i].commanded || !blinds[i].commandSent) {
 			continue;
 		}
-		if (!differsBy(blinds[i].lastChangedTime, now, 4000)) {
+		// A motor that reports the same ticks again after it has started has
+		// stopped, there's no need to wait for the timeout
+		bool stalled = blinds[i].commandAcked && blinds[i].ticksStable >= STALL_REPLIES;
+		if (!stalled && !differsBy(blinds[i].lastChangedTime, now, JAM_TIMEOUT)) {
 			// The blinds are still moving, nothing to do
 			continue;
 		}
@@ -634,43 +1585,154 @@ void detectJams() {
 		}
 
 		blinds[i].commandSent = blinds[i].commandAcked = 0; // Force the re-send of the command
+		blinds[i].moveStartTime = 0; // The stall would spoil the travel rate
 		blinds[i].lastUnjamTryTime = now;
 		blinds[i].unjamTryCount++;
 	}
 }
 
+// Single-letter commands on the debug serial
+void dumpTicks() {
+	Serial.println("Blind: ticks, fine position, calibration pct@ticks");
+	for(byte i=0; i<numBlinds; ++i) {
+		Serial.print(i); Serial.print(": ");
+		Serial.print(blinds[i].ticks); Serial.print(" ");
+		Serial.print(finePosition(i)); Serial.print(" ");
+		if (blinds[i].calPctLow == 0xFF) {
+			Serial.println("-");
+			continue;
+		}
+		Serial.print(blinds[i].calPctLow); Serial.print("@"); Serial.print(blinds[i].calTicksLow);
+		Serial.print(" "); Serial.print(blinds[i].calPctHigh); Serial.print("@");
+		Serial.println(blinds[i].calTicksHigh);
+	}
+}
+
+void dumpGroupMove() {
+	Serial.print("Group move, ms: unplanned spread "); Serial.print(groupUnplannedSpread);
+	Serial.print(" planned "); Serial.print(groupPlannedSpread);
+	Serial.print(" actual "); Serial.print(groupActualSpread);
+	Serial.print(" pending "); Serial.println(groupRemaining);
+	Serial.println("Blind: travel rate 0.01%/s");
+	for(byte i=0; i<numBlinds; ++i) {
+		Serial.print(i); Serial.print(": ");
+		Serial.println(blinds[i].travelRate);
+	}
+}
+
+void dumpScenes() {
+	for(byte n=1; n<=SCENES; ++n) {
+		word addr = SCENE_ADDR + (n - 1) * SCENE_LEN;
+		byte count = EEPROM.read(addr);
+		Serial.print("Scene "); Serial.print(n); Serial.print(":");
+		if (count > MAX_BLINDS) {
+			Serial.println(" -");
+			continue;
+		}
+		for(byte e=0; e<count; ++e) {
+			word entry = addr + 1 + e * SCENE_ENTRY_LEN;
+			Serial.print(" "); Serial.print(EEPROM.read(entry));
+			Serial.print("@"); Serial.print(EEPROM.read(entry + 1));
+		}
+		Serial.println();
+	}
+}
+
+void dumpLinkQuality() {
+	Serial.println("Blind: link quality, status attempts/command copies");
+	for(byte i=0; i<numBlinds; ++i) {
+		Serial.print(i); Serial.print(": ");
+		Serial.print(blinds[i].linkQuality); Serial.print(" ");
+		Serial.print(statusAttempts(i)); Serial.print("/");
+		Serial.println(commandCopies(i));
+	}
+}
+
+void checkDebugCommands() {
+	while(Serial.available()) {
+		byte cmd = Serial.read();
+#ifdef PROFILE_LOOP
+		if (cmd == 'p') {
+			dumpLoopStats();
+		} else if (cmd == 'r') {
+			resetLoopStats();
+		}
+#endif
+		if (cmd == 'h') {
+			dumpBusHealth(numBlinds);
+			dumpLinkQuality();
+		} else if (cmd == 'c') {
+			resetBusHealth();
+			resetReportStats();
+			resetBudgetStats();
+		} else if (cmd == 'q') {
+			dumpReportStats();
+		} else if (cmd == 't') {
+			dumpTicks();
+		} else if (cmd == 'g') {
+			dumpGroupMove();
+		} else if (cmd == 'n') {
+			dumpScenes();
+		} else if (cmd == 'b') {
+			dumpBudgetStats();
+		} else if (cmd == 's') {
+			Serial.print("Stop latency ms, last: "); Serial.print(lastStopLatency);
+			Serial.print(" max: "); Serial.println(maxStopLatency);
+		}
+	}
+}
+
+void statusChanged() {
+	if (!statusPending) {
+		statusPending = 1;
+	}
+}
+
 void real_loop() { // run over and over
+	budgetBegin();
 	if (globalMode == DISCOVERY) {
+		budgetPhase(PHASE_DISCOVERY);
+		PROFILE_BEGIN(PHASE_DISCOVERY)
 		runDiscoveryAttempt();
+		PROFILE_END(PHASE_DISCOVERY)
 
 		if ((numBlinds != 0 && digitalRead(BTN_PIN) == LOW) ||	numBlinds == MAX_BLINDS) {
 			// Button is pressed - switch into the join mode if
 			// we have at least one shutter discovered.
 			saveBlindSettings();
 			setMode(JOINING);
-			oled.clrscr();
+			clearScreen();
 			printStatus();
 			zunoReboot();
 		}
-		delay(200);
+		flushLog();
+		budgetEnd();
+		// The late replies are still parsed before the next broadcast
+		serviceDelay(200);
 		return;
 	}
 
-	if (digitalRead(BTN_PIN) == LOW) {
+	budgetPhase(PHASE_BUTTON);
+	PROFILE_BEGIN(PHASE_BUTTON)
+	buttonService();
+	if (buttonPressed()) {
 		lastInterestingTime = millis();
 	}
-	checkResetOrInclude();
+	checkButton();
+	PROFILE_END(PHASE_BUTTON)
 
 	if (globalMode == OPERATION && !zunoInNetwork()) {
 		setMode(JOINING);
-		oled.clrscr();
+		clearScreen();
+		budgetEnd();
 		return;
 	}
 
 	if (globalMode == JOINING) {
 		if (zunoInNetwork()) {
 			setMode(OPERATION);
-			oled.clrscr();
+			clearScreen();
+			budgetEnd();
 			return;
 		}
 		// Start the unsecure inclusion
@@ -678,131 +1740,350 @@ void real_loop() { // run over and over
 			zunoStartLearn(10, 0);
 			learningStarted = 1;
 		}
+		flushLog();
+		budgetEnd();
 		delay(500);
 		return;
 	}
 
+	checkDebugCommands();
+
 	// Interact with Zwave
+	budgetPhase(PHASE_ZWAVE_SETTERS);
+	PROFILE_BEGIN(PHASE_ZWAVE_SETTERS)
 	checkZwaveSetters();
 	updateZwaveValues();
+	PROFILE_END(PHASE_ZWAVE_SETTERS)
+
+	pumpBus();
+	if (busChanged) {
+		// Another controller is moving the blinds or polling them
+		busChanged = 0;
+		lastInterestingTime = millis();
+		statusChanged();
+	}
 
 	// Avoid polling the motor states too often, once every 600 seconds for normal periods
 	// and once every 1 second for interesting events. Also do it while the OLED is on.
 	bool shouldReadStates = lastTimeRead == 0;
-	if (differsBy(millis(), lastInterestingTime, 20000) && oledIsOff) {
+	if (differsBy(millis(), lastInterestingTime, 20000) && oledPower == OLED_POWER_OFF) {
 		shouldReadStates |= differsBy(millis(), lastTimeRead, 600000);
 	} else {
 		shouldReadStates |= differsBy(millis(), lastTimeRead, 1000);
 	}
+	shouldReadStates |= pollPassPending;
 
+	bool isCommanded = false;
 	if (globalMode == OPERATION) {
 		// Process the commands
-		bool isCommanded = false, shouldReport = false;
-		processCommandedStatus(&isCommanded, &shouldReport);
+		budgetPhase(PHASE_COMMANDS);
+		PROFILE_BEGIN(PHASE_COMMANDS)
+		processCommandedStatus(&isCommanded);
+		PROFILE_END(PHASE_COMMANDS)
 		if (isCommanded) {
 			lastInterestingTime = millis();
 			shouldReadStates = true;
 		}
-		if (shouldReport) {
-			sendReportThrottled(true);
-		}
 	}
 
 	if (shouldReadStates) {
-		lastTimeRead = millis();
-		if (readMotorStates()) {
+		if (!pollPassPending) {
+			// The interval counts from the start of the pass
+			lastTimeRead = millis();
+		}
+		budgetPhase(PHASE_READ_STATES);
+		PROFILE_BEGIN(PHASE_READ_STATES)
+		bool statesChanged = readMotorStates();
+		PROFILE_END(PHASE_READ_STATES)
+		if (statesChanged) {
 			// Something has changed in the motor states - always treat it as an
 			// interesting event.
 			lastInterestingTime = millis();
 		}
-		printStatus();
+		statusChanged();
+		budgetPhase(PHASE_DETECT_JAMS);
+		PROFILE_BEGIN(PHASE_DETECT_JAMS)
 		detectJams();
-		sendReportThrottled(false);
+		PROFILE_END(PHASE_DETECT_JAMS)
+		savePositions();
+		budgetPhase(PHASE_REPORT);
+		PROFILE_BEGIN(PHASE_REPORT)
+		sendReportThrottled();
+		PROFILE_END(PHASE_REPORT)
+	}
+	reportShaperService();
+
+	if (statusPending > STATUS_MAX_WAIT || (statusPending && budgetAllows(STATUS_COST))) {
+		budgetPhase(PHASE_PRINT_STATUS);
+		PROFILE_BEGIN(PHASE_PRINT_STATUS)
+		statusPending = 0;
+		printStatus();
+		PROFILE_END(PHASE_PRINT_STATUS)
+	} else if (statusPending) {
+		statusPending++;
+	}
+
+	// The loop is idle now, it's a good time to send out the log
+	flushLog();
+	budgetEnd();
+
+	PROFILE_BEGIN(PHASE_DELAY)
+	// The online discovery takes its time out of the idle delay, so the
+	// commands are picked up as often as without it
+	dword idleStarted = millis();
+	if (globalMode == OPERATION && !isCommanded) {
+		serviceOnlineDiscovery();
 	}
+	dword discoveryTime = millis() - idleStarted;
+	idleDelay(discoveryTime < 300 ? 300 - discoveryTime : 0);
+	PROFILE_END(PHASE_DELAY)
+}
+
+// Stop all the motors with a single frame per bus, the zero address is the
+// group address for all the motors on the bus. The buses send it at the
+// same time.
+void sendStopCommand() {
+	byte stopMotor[] = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFF};
+	for(byte b=0; b<NUM_BUSES; ++b) {
+		queueSomfyMessage(b, STOP_MOTOR, stopMotor, sizeof(stopMotor));
+	}
+	flushBuses();
+}
+
+// Send out the pending stop request, returns true if there was one
+bool serviceStopLane() {
+	if (!stopRequested) {
+		return false;
+	}
+	stopRequested = 0;
+	sendStopCommand();
 
-	delay(300);
+	lastStopLatency = millis() - stopRequestedTime;
+	if (lastStopLatency > maxStopLatency) {
+		maxStopLatency = lastStopLatency;
+	}
+	// The motors are stopping, don't let a queued move command restart them.
+	// The rest of the bookkeeping happens in processCommandedStatus().
+	for(byte i=0; i<numBlinds; ++i) {
+		if (blinds[i].stopCommanded) {
+			blinds[i].commanded = 0;
+			blinds[i].commandedTime = 0;
+		}
+	}
+	// Send the command multiple times to be sure, the stop is for all the
+	// motors so the worst link decides
+	byte copies = 1;
+	for(byte i=0; i<numBlinds; ++i) {
+		if (!blinds[i].isOffline) {
+			copies = max(copies, commandCopies(i));
+		}
+	}
+	stopDuplicatesPending = copies - 1;
+	return true;
 }
 
-void sendStopCommand(int i) {
-  byte stopMotor[]   = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFF};
-  byte size = sizeof(stopMotor);
-  
-  // Send the command multiple times to be sure
-	for(int k=0; k<2; ++k) {
-		sendSomfyMessage(STOP_MOTOR, stopMotor, size);
-		delay(40);
+void serviceDelayStep(word ms, byte step) {
+	dword start = millis();
+	while(!differsBy(millis(), start, ms)) {
+		watchdogService();
+		serviceStopLane();
+		pumpBus();
+		reportShaperService();
+		buttonService();
+		delay(step);
 	}
+	serviceStopLane();
+	pumpBus();
 }
 
-void sendMoveCommands(int i){                          
-	byte moveMotorUp[]   = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFEu, 0xFF, 0xFF, 0xFF};
-	byte moveMotorDown[] = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFFu, 0xFF, 0xFF, 0xFF};
-	byte moveMotor[]     = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFBu, 0,    0xFF, 0xFF};
+// A delay() that keeps servicing the stop requests, the bus traffic and the
+// queued reports
+void serviceDelay(word ms) {
+	serviceDelayStep(ms, STOP_POLL_INTERVAL);
+}
 
-	byte msgId, size;
-	byte *msg;
-	Serial.print("Commanding blind "); Serial.print(i);
-	if (blinds[i].commandedPercent == 0) {
+// The pause at the end of the loop. The blinds that have moved in the last
+// 20 seconds, the same time that keeps the polling fast, keep the stop lane
+// at its full rate.
+void idleDelay(word ms) {
+	if (differsBy(millis(), lastInterestingTime, 20000)) {
+		serviceDelayStep(ms, IDLE_POLL_INTERVAL);
+	} else {
+		serviceDelayStep(ms, STOP_POLL_INTERVAL);
+	}
+}
+
+// Keep servicing the bus until it has been quiet for the given time. The
+// replies that are still arriving extend the wait, by as much as the rest
+// of the frame needs.
+void waitBusQuiet(word quietTime) {
+	dword quietSince = millis();
+	while(true) {
+		watchdogService();
+		serviceStopLane();
+		word wait = quietTime;
+		for(byte b=0; b<NUM_BUSES; ++b) {
+			if (buses[b]->available()) {
+				quietSince = millis();
+			}
+		}
+		pumpBus();
+		for(byte b=0; b<NUM_BUSES; ++b) {
+			word frameWait = FRAME_TIME(frameParserMissing(&busParsers[b])) + FRAME_GAP_TIMEOUT;
+			if (wait < frameWait) {
+				wait = frameWait;
+			}
+		}
+		if (differsBy(millis(), quietSince, wait)) {
+			break;
+		}
+		buttonService();
+		delay(STOP_POLL_INTERVAL);
+	}
+	pumpBus();
+}
+
+// The payload of the command that moves the blind to the position, 0 and 99
+// are the limits. Both commands have the same id and the same length.
+void moveCommandPayload(byte i, byte percent, byte *msg) {
+	byte moveMotor[] = {0x80u, 0x80u, 0x80u, 00, 00, 00, 0xFBu, 0, 0xFF, 0xFF};
+	memcpy(msg, moveMotor, MOVE_PAYLOAD_LEN);
+	if (percent == 0) {
 		// Opening blinds fully
-		Serial.println(" to move up to the limit");
-		msgId = MOVE_MOTOR_TO_LIMIT;
-		msg = moveMotorUp;
-		size = sizeof(moveMotorUp);
-	} else if (blinds[i].commandedPercent == 99) {
+		msg[6] = 0xFEu;
+		msg[7] = 0xFFu;
+	} else if (percent == 99) {
 		// Closing blinds fully
-		Serial.println(" to move down to the limit");
-		msgId = MOVE_MOTOR_TO_LIMIT;
-		msg = moveMotorDown;
-		size = sizeof(moveMotorDown);
+		msg[6] = 0xFFu;
+		msg[7] = 0xFFu;
 	} else {
-		Serial.print(" to move to position ");
-		Serial.println(blinds[i].commandedPercent);
-		// Send out the command to move
-		msgId = MOVE_MOTOR_TO_POS;
-		msg = moveMotor;
-		msg[7] = 0xFF - blinds[i].commandedPercent;
-		size = sizeof(moveMotor);
+		msg[7] = 0xFF - percent;
 	}
-
 	msg[3] = blinds[i].addr1;
 	msg[4] = blinds[i].addr2;
 	msg[5] = blinds[i].addr3;
+}
 
-	// Send the command multiple times to be sure
-	for(int k=0; k<2; ++k) {
-		sendSomfyMessage(msgId, msg, size);
-		delay(40);
+void sendMoveCommands(int i){
+	byte msg[MOVE_PAYLOAD_LEN];
+	if (blinds[i].commandedPercent == 0) {
+		LOG_INFO(EV_MOVE_UP, i, 0);
+	} else if (blinds[i].commandedPercent == 99) {
+		LOG_INFO(EV_MOVE_DOWN, i, 0);
+	} else {
+		LOG_INFO(EV_MOVE_TO, i, blinds[i].commandedPercent);
+	}
+	moveCommandPayload(i, blinds[i].commandedPercent, msg);
+
+	// Send the command multiple times on bad links. The frame has already
+	// left when sendSomfyMessage() returns, the motors only need a silent gap
+	// to tell the frames apart.
+	byte copies = commandCopies(i);
+	for(byte k=0; k<copies; ++k) {
+		sendSomfyMessage(blinds[i].bus, MOVE_MOTOR_TO_POS, msg, MOVE_PAYLOAD_LEN);
+		serviceDelay(FRAME_GAP_TIMEOUT);
 	}
 	blinds[i].commandSent = 1;
 }
 
-void processCommandedStatus(bool *hasCommanded, bool *shouldSendReport) {
+// Store the confirmed positions of the online blinds as the scene n, with
+// their move frames encoded
+void storeScene(byte n) {
+	if (n == 0 || n > SCENES) {
+		return;
+	}
+	word addr = SCENE_ADDR + (n - 1) * SCENE_LEN;
+	byte msg[MOVE_PAYLOAD_LEN];
+	byte frame[MAX_FRAME_LEN];
+	byte count = 0;
+	// A scene cut short by a reset reads as not stored
+	updateEeprom(addr, 0xFF);
+	for(byte i=0; i<numBlinds; ++i) {
+		if (!blinds[i].positionVerified || blinds[i].isOffline) {
+			continue;
+		}
+		byte percent = min(99, blinds[i].curPercentage);
+		moveCommandPayload(i, percent, msg);
+		encodeSomfyMessage(frame, MOVE_MOTOR_TO_POS, msg, MOVE_PAYLOAD_LEN);
+		word entry = addr + 1 + count * SCENE_ENTRY_LEN;
+		updateEeprom(entry, i);
+		updateEeprom(entry + 1, percent);
+		for(byte k=0; k<MAX_FRAME_LEN; ++k) {
+			updateEeprom(entry + 2 + k, frame[k]);
+		}
+		count++;
+	}
+	updateEeprom(addr, count);
+	LOG_INFO(EV_SCENE_STORED, count, n);
+}
+
+// Put the stored frames of the scene on the buses as they are. The buses
+// send at the same time, the frames on the same bus are a gap apart.
+void runScene(byte n) {
+	word addr = SCENE_ADDR + (n - 1) * SCENE_LEN;
+	byte count = EEPROM.read(addr);
+	if (count > MAX_BLINDS) {
+		return;
+	}
+	LOG_INFO(EV_SCENE_RUN, count, n);
+	// A bit per bus that already has a frame queued
+	byte queued = 0;
+	for(byte e=0; e<count; ++e) {
+		word entry = addr + 1 + e * SCENE_ENTRY_LEN;
+		byte i = EEPROM.read(entry);
+		if (i >= numBlinds || blinds[i].stopCommanded) {
+			continue;
+		}
+		byte bus = blinds[i].bus;
+		if (queued & (1 << bus)) {
+			flushBuses();
+			serviceDelay(FRAME_GAP_TIMEOUT);
+			queued = 0;
+		}
+		for(byte k=0; k<MAX_FRAME_LEN; ++k) {
+			buses[bus]->write(EEPROM.read(entry + 2 + k));
+		}
+		queued |= 1 << bus;
+
+		leaveGroup(i, false);
+		blinds[i].commandedPercent = EEPROM.read(entry + 1);
+		blinds[i].commanded = 1;
+		blinds[i].commandedTime = millis();
+		blinds[i].commandSent = 1;
+		blinds[i].commandAcked = 0;
+		blinds[i].moveStartTime = 0;
+	}
+	flushBuses();
+}
+
+void processCommandedStatus(bool *hasCommanded) {
 	bool commandSent = false;
 
 	for(byte i=0; i<numBlinds; ++i) {
+		// The stop lane clears the commanded state of the stopped blinds
+		serviceStopLane();
 		if (!blinds[i].commanded && !blinds[i].stopCommanded) {
 			continue;
 		}
 		*hasCommanded = true; // We have commanded blinds, this is always an interesting event
 
-    if (blinds[i].stopCommanded) {
-			blinds[i].commanded = 0;
-			blinds[i].commandedTime = 0;
-      blinds[i].stopCommanded = 0;
-			*shouldSendReport = true;
-			Serial.print("Blind "); Serial.print(i);
-			Serial.println(" has been commanded to stop");
-      sendStopCommand(i);
-      commandSent = true;
-      continue;
-    }
+		if (blinds[i].stopCommanded) {
+			blinds[i].stopCommanded = 0;
+			blinds[i].moveStartTime = 0;
+			leaveGroup(i, false);
+			reportBlind(i);
+			LOG_INFO(EV_STOPPED, i, 0);
+			continue;
+		}
 
-		if (!differsBy(blinds[i].commandedPercent, blinds[i].curPercentage, 2)) {
+		// A cached position might be stale, don't skip the move because of it
+		if (blinds[i].positionVerified && hasArrived(i)) {
 			blinds[i].commanded = 0;
 			blinds[i].commandedTime = 0;
-			*shouldSendReport = true;
-			Serial.print("Blind "); Serial.print(i);
-			Serial.println(" has finished moving");
+			measureTravelRate(i);
+			leaveGroup(i, blinds[i].commandSent);
+			reportBlind(i);
+			LOG_INFO(EV_FINISHED, i, 0);
 			continue;
 		}
 
@@ -810,9 +2091,10 @@ void processCommandedStatus(bool *hasCommanded, bool *shouldSendReport) {
 			// The command is taking too long - reset the commanded status
 			blinds[i].commanded = 0;
 			blinds[i].commandedTime = 0;
-			*shouldSendReport = true;
-			Serial.print("Blind "); Serial.print(i);
-			Serial.println(" has timed out while moving");
+			blinds[i].moveStartTime = 0;
+			leaveGroup(i, false);
+			reportBlind(i);
+			LOG_INFO(EV_TIMED_OUT, i, 0);
 			continue;
 		}
 
@@ -820,14 +2102,33 @@ void processCommandedStatus(bool *hasCommanded, bool *shouldSendReport) {
 			// No need to send the command multiple times
 			continue;
 		}
+		if (!blinds[i].commandSent && isBefore(millis(), blinds[i].commandedTime)) {
+			// Held back by the group move
+			continue;
+		}
 
 		sendMoveCommands(i);
 		commandSent = true;
 	}
 
+	if (pendingScene) {
+		runScene(pendingScene);
+		pendingScene = 0;
+		*hasCommanded = true;
+		commandSent = true;
+	}
+
+	while(stopDuplicatesPending) {
+		stopDuplicatesPending--;
+		serviceDelay(FRAME_GAP_TIMEOUT);
+		sendStopCommand();
+		commandSent = true;
+	}
+
 	if (commandSent) {
-		delay(100); // Delay to allow Somfy to process the messages
-		blindsSerial.drain();
+		// Let the motors answer the commands, if they do
+		waitBusQuiet(MOTOR_REPLY_DELAY);
+		drainBus();
 	}
 }
 
@@ -837,6 +2138,10 @@ void zunoSWMLCallback(byte dir,byte channel) {
     for(int i =0; i < numBlinds; i++) {
       blinds[i].stopCommanded = 1;
     }
+    if (!stopRequested) {
+      stopRequestedTime = millis();
+      stopRequested = 1;
+    }
   }
 }
 
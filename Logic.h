@@ -1,5 +1,43 @@
 #pragma once
 
+// The per-blind tables take 84 bytes of RAM per blind: 58 in the blind
+// state, 26 in the bus statistics. The EEPROM layout below moves with it.
+#ifndef MAX_BLINDS
+#define MAX_BLINDS 12
+#endif
+
+// The longest frame we send, the move command
+#define MAX_FRAME_LEN 15
+
+// The EEPROM layout. The mode is 0 for the discovery, 1 for joining and 2
+// for the operation.
+#define MODE_ADDR 1
+#define NUM_BLINDS_ADDR 2
+// The blind addresses, 3 bytes per blind
+#define BLINDS_ADDR 3
+// The last known positions survive the reboots, one byte per blind after
+// the blind addresses. 0xFF means unknown.
+#define POSITION_CACHE_ADDR (BLINDS_ADDR + MAX_BLINDS * 3)
+// The bus of each blind follows the position cache, the motors that were
+// discovered before the second bus existed read 0xFF and stay on the bus 0
+#define BUS_MAP_ADDR (POSITION_CACHE_ADDR + MAX_BLINDS)
+// The measured travel rates, a word per blind
+#define TRAVEL_RATE_ADDR (BUS_MAP_ADDR + MAX_BLINDS)
+// The scenes, see Logic.cpp. An entry: [blind, percent] + the frame
+#define SCENES 4
+#define SCENE_ENTRY_LEN (2 + MAX_FRAME_LEN)
+// A scene: [number of entries, 0xFF if not stored] + entries
+#define SCENE_LEN (1 + MAX_BLINDS * SCENE_ENTRY_LEN)
+#define SCENE_ADDR (TRAVEL_RATE_ADDR + MAX_BLINDS * 2)
+// The loop phase the watchdog fired in, 0xFF if it didn't
+#define WATCHDOG_ADDR (SCENE_ADDR + SCENES * SCENE_LEN)
+
+// The number of RS-485 buses, each one has its own transceiver. The blinds
+// on different buses are polled at the same time.
+#ifndef NUM_BUSES
+#define NUM_BUSES 1
+#endif
+
 extern void real_setup();
 extern void real_loop();
 extern void realZunoCallback();
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "LoopBudget.h"
+#include "EEPROM.h"
+#include "DebugLog.h"
+
+BudgetStats g_budget_stats;
+
+// The iteration in progress, g_budget_open is 0 between the iterations
+byte g_budget_open;
+dword g_budget_started, g_phase_started;
+byte g_budget_culprit;
+word g_budget_culprit_time;
+// The current phase, recorded by the watchdog
+byte g_budget_phase = PHASE_DELAY;
+
+// The end of the last healthy iteration, the watchdog is armed by the first
+// one
+byte g_watchdog_armed;
+dword g_watchdog_fed_time;
+word g_watchdog_addr;
+
+void watchdogBegin(word eepromAddr) {
+	g_watchdog_addr = eepromAddr;
+	g_watchdog_armed = 0;
+	byte phase = EEPROM.read(eepromAddr);
+	if (phase != 0xFF) {
+		LOG_INFO(EV_WATCHDOG_RESET, phase, 0);
+		EEPROM.write(eepromAddr, 0xFF);
+	}
+}
+
+void watchdogService() {
+	if (!g_watchdog_armed || millis() - g_watchdog_fed_time < WATCHDOG_TIMEOUT) {
+		return;
+	}
+	// Fire once, the reboot doesn't return on the board
+	g_watchdog_armed = 0;
+	EEPROM.write(g_watchdog_addr, g_budget_phase);
+	zunoReboot();
+}
+
+void budgetBegin() {
+	watchdogService();
+	g_budget_open = 1;
+	g_budget_started = millis();
+	g_phase_started = g_budget_started;
+	g_budget_culprit = PHASE_COUNT;
+	g_budget_culprit_time = 0;
+}
+
+static void closePhase(dword now) {
+	dword elapsed = now - g_phase_started;
+	if (g_budget_culprit == PHASE_COUNT || elapsed > g_budget_culprit_time) {
+		g_budget_culprit = g_budget_phase;
+		g_budget_culprit_time = elapsed > 0xFFFFu ? 0xFFFFu : word(elapsed);
+	}
+	g_phase_started = now;
+}
+
+void budgetPhase(byte phase) {
+	if (g_budget_open) {
+		closePhase(millis());
+	}
+	g_budget_phase = phase;
+}
+
+bool budgetAllows(word cost) {
+	if (!g_budget_open) {
+		return true;
+	}
+	return millis() - g_budget_started + cost <= LOOP_BUDGET;
+}
+
+void budgetEnd() {
+	if (!g_budget_open) {
+		return;
+	}
+	dword now = millis();
+	closePhase(now);
+	g_budget_open = 0;
+	g_budget_phase = PHASE_DELAY;
+
+	dword elapsed = now - g_budget_started;
+	word clamped = elapsed > 0xFFFFu ? 0xFFFFu : word(elapsed);
+	g_budget_stats.loops++;
+	if (clamped > g_budget_stats.maxLoopTime) {
+		g_budget_stats.maxLoopTime = clamped;
+	}
+	if (elapsed <= WATCHDOG_LOOP_LIMIT) {
+		g_watchdog_armed = 1;
+		g_watchdog_fed_time = now;
+	}
+	if (elapsed <= LOOP_BUDGET) {
+		return;
+	}
+	byte culprit = g_budget_culprit;
+	g_budget_stats.overruns++;
+	g_budget_stats.culprit[culprit]++;
+	if (g_budget_culprit_time > g_budget_stats.culpritMaxTime[culprit]) {
+		g_budget_stats.culpritMaxTime[culprit] = g_budget_culprit_time;
+	}
+	LOG_INFO(EV_LOOP_OVERRUN, culprit, g_budget_culprit_time);
+}
+
+void resetBudgetStats() {
+	for(byte k=0; k<sizeof(BudgetStats); ++k) {
+		((byte*)&g_budget_stats)[k] = 0;
+	}
+}
+
+void dumpBudgetStats() {
+	Serial.print("Loops: "); Serial.print(g_budget_stats.loops);
+	Serial.print(" over "); Serial.print(LOOP_BUDGET);
+	Serial.print(" ms: "); Serial.print(g_budget_stats.overruns);
+	Serial.print(" max ms: "); Serial.println(g_budget_stats.maxLoopTime);
+	Serial.println("Culprit: overruns max ms");
+	for(byte i=0; i<PHASE_COUNT; ++i) {
+		if (g_budget_stats.culprit[i] == 0) {
+			continue;
+		}
+		Serial.print(phaseName(i)); Serial.print(": ");
+		Serial.print(g_budget_stats.culprit[i]); Serial.print(" ");
+		Serial.println(g_budget_stats.culpritMaxTime[i]);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Arduino.h"
+#include "LoopStats.h"
+
+// The time budget of a main loop iteration, not counting the idle delay at
+// its end. The work that can wait asks budgetAllows() with its expected
+// cost before it starts, and what doesn't fit is left for the next
+// iteration. An iteration that still runs over the budget is recorded
+// with the phase that took the longest in it.
+#ifndef LOOP_BUDGET
+#define LOOP_BUDGET 150 // ms
+#endif
+
+// An iteration up to this long is healthy and feeds the watchdog. A longer
+// one is waiting on something that doesn't end, like a line that never
+// goes quiet.
+#define WATCHDOG_LOOP_LIMIT 5000 // ms
+// The watchdog reboots the board if there has been no healthy iteration for
+// this long. It is checked at the start of each iteration, in the waits
+// for the bus and in the waits of the soft serial for its timer, which is
+// where a loop that doesn't end spends its time. It stays out of the
+// interrupts: the EEPROM write and the reboot are system calls that aren't
+// meant for them. The phase that was running is stored in the EEPROM and
+// logged after the reboot.
+// It is not a hardware watchdog: a wait that doesn't call it isn't covered.
+// That is a stuck I2C transfer to the display, which waits inside the Wire
+// library, and a hang in the system calls or in an interrupt handler.
+#define WATCHDOG_TIMEOUT 30000 // ms
+
+// All times are in milliseconds
+struct BudgetStats {
+	dword loops, overruns;
+	word maxLoopTime;
+	// Per phase: the overruns it was the culprit of and its longest time in them
+	word culprit[PHASE_COUNT];
+	word culpritMaxTime[PHASE_COUNT];
+};
+
+extern BudgetStats g_budget_stats;
+
+// Set up the watchdog with the EEPROM byte for the phase it fired in, log
+// the previous watchdog reset if there was one. The first healthy iteration
+// arms it.
+void watchdogBegin(word eepromAddr);
+// Reboot if the watchdog has run out, call it from the waits
+void watchdogService();
+
+// Start the budget of an iteration, check the watchdog
+void budgetBegin();
+// The loop enters the phase, the time until the next call is charged to it
+void budgetPhase(byte phase);
+// Whether the work of this cost fits into the rest of the budget. Outside
+// of an iteration everything fits.
+bool budgetAllows(word cost);
+// End the iteration: record an overrun, feed the watchdog if it was healthy
+void budgetEnd();
+
+void resetBudgetStats();
+// Print the overrun counters to the debug serial
+void dumpBudgetStats();
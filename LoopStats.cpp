@@ -0,0 +1,64 @@
+#include "LoopStats.h"
+
+const char *phaseName(byte phase) {
+	switch(phase) {
+	case PHASE_ZWAVE_SETTERS: return "zwave";
+	case PHASE_COMMANDS: return "commands";
+	case PHASE_READ_STATES: return "read states";
+	case PHASE_PRINT_STATUS: return "print status";
+	case PHASE_DETECT_JAMS: return "detect jams";
+	case PHASE_REPORT: return "report";
+	case PHASE_DELAY: return "delay";
+	case PHASE_BUTTON: return "button";
+	case PHASE_DISCOVERY: return "discovery";
+	}
+	return "?";
+}
+
+#ifdef PROFILE_LOOP
+
+PhaseStats g_phase_stats[PHASE_COUNT];
+
+void resetLoopStats() {
+	for(byte i=0; i<PHASE_COUNT; ++i) {
+		g_phase_stats[i].calls = 0;
+		g_phase_stats[i].totalTime = 0;
+		g_phase_stats[i].minTime = 0xFFFFu;
+		g_phase_stats[i].maxTime = 0;
+	}
+}
+
+void profilePhaseEnd(byte phase, dword started) {
+	dword elapsed = millis() - started;
+	word clamped = elapsed > 0xFFFFu ? 0xFFFFu : word(elapsed);
+	PhaseStats *st = &g_phase_stats[phase];
+	if (st->calls == 0) {
+		st->minTime = 0xFFFFu;
+	}
+	st->calls++;
+	st->totalTime += elapsed;
+	if (clamped < st->minTime) {
+		st->minTime = clamped;
+	}
+	if (clamped > st->maxTime) {
+		st->maxTime = clamped;
+	}
+}
+
+void dumpLoopStats() {
+	Serial.println("Phase: calls min/avg/max ms");
+	for(byte i=0; i<PHASE_COUNT; ++i) {
+		PhaseStats *st = &g_phase_stats[i];
+		Serial.print(phaseName(i)); Serial.print(": ");
+		Serial.print(st->calls); Serial.print(" ");
+		if (st->calls == 0) {
+			Serial.println("-");
+			continue;
+		}
+		Serial.print(st->minTime); Serial.print("/");
+		Serial.print(st->totalTime / st->calls); Serial.print("/");
+		Serial.println(st->maxTime);
+	}
+}
+
+#endif
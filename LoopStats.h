@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Per-phase timing of the main loop. Uncomment to collect the statistics,
+// when disabled the PROFILE_* macros compile to nothing.
+//#define PROFILE_LOOP
+
+enum loop_phase_t {
+	PHASE_ZWAVE_SETTERS,
+	PHASE_COMMANDS,
+	PHASE_READ_STATES,
+	PHASE_PRINT_STATUS,
+	PHASE_DETECT_JAMS,
+	PHASE_REPORT,
+	PHASE_DELAY,
+	PHASE_BUTTON,
+	PHASE_DISCOVERY,
+	PHASE_COUNT
+};
+
+// All times are in milliseconds
+struct PhaseStats {
+	dword calls;
+	dword totalTime;
+	word minTime, maxTime;
+};
+
+const char *phaseName(byte phase);
+
+#ifdef PROFILE_LOOP
+extern PhaseStats g_phase_stats[PHASE_COUNT];
+
+void profilePhaseEnd(byte phase, dword started);
+// Print the statistics table to the debug serial
+void dumpLoopStats();
+void resetLoopStats();
+
+#define PROFILE_BEGIN(phase) dword profile_started_##phase = millis();
+#define PROFILE_END(phase) profilePhaseEnd(phase, profile_started_##phase);
+#else
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+#endif
@@ -1,21 +1,11 @@
 #include "OddSoftSer.h"
 #include "Arduino.h"
 
-extern s_pin g_rx_pin;
-extern byte g_rcv_state;
-extern byte g_cb;
-extern byte g_rcv_buff[MAX_RCV_BUFFER];
-extern byte g_write_pos;
-extern byte g_read_pos;
-extern byte g_parity;
-
 #ifndef __CLION_IDE__
 ZUNO_SETUP_ISR_GPTIMER(softserial_gpt_handler);
 #endif
 
-#define DIRECTION_CONTROL_PIN 2
-
-#define CONST_USECONDS_OFFSET 10 // uS
+// Receiver states, in half-bits
 #define START_BIT_1HALF       0
 #define START_BIT_2HALF       1
 #define PARITY_BIT_1HALF      18
@@ -23,164 +13,344 @@ ZUNO_SETUP_ISR_GPTIMER(softserial_gpt_handler);
 #define STOP_BIT_1HALF        20
 #define STOP_BIT_2HALF        21
 
+// Sender states, in half-bits. The odd states start a bit: 1 is the start
+// bit, 3..17 are the data bits, 19 the parity and 21 the stop bit. 23 is the
+// end of the stop bit, where the next byte starts right away.
+#define SND_IDLE              0
+#define SND_START_BIT         1
+#define SND_PARITY_BIT        19
+#define SND_STOP_BIT          21
+#define SND_BYTE_DONE         23
+
+SoftSerPort g_ports[SOFT_SERIAL_PORTS];
+byte g_num_ports = 0;
+
+// The number of ports that are sending or in the middle of a received byte.
+// While it's 0 the handler only looks for the start bits.
+volatile byte g_ports_busy = 0;
+// Ticks since the last activity on any port. The lines are considered idle
+// after SOFT_SERIAL_IDLE_TICKS, the flag saves the main loop from reading
+// the word while the handler changes it.
+word g_idle_ticks = 0;
+volatile byte g_lines_idle = 0;
+byte g_listening = 0;
+byte g_gpt_running = 0;
+void (*g_soft_serial_wait)() = 0;
+
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection"
 
-// Since we can't really access the software serial instance, we just use
-// global variables in the interrupt handler.
-void softserial_gpt_handler() {
-	if (g_rcv_state == START_BIT_1HALF) {
-		if (!digitalRead(g_rx_pin)) {
-			g_cb = 0;
-			g_parity = 0;
-			g_rcv_state++;
-		}
-		return;
+#ifdef SOFT_SERIAL_RUNTIME_PINS
+// The pins are read from the port states
+#define SST_SUFFIX
+#define SST_TX_PIN port->tx_pin
+#define SST_RX_PIN port->rx_pin
+#define SST_DIR_PIN port->dir_pin
+#include "OddSoftSerTicks.h"
+#undef SST_SUFFIX
+#undef SST_TX_PIN
+#undef SST_RX_PIN
+#undef SST_DIR_PIN
+
+static void detectStartBits() {
+	for(byte i=0; i<g_num_ports; ++i) {
+		detectStartBit(&g_ports[i]);
 	}
-	if (g_rcv_state == START_BIT_2HALF) {
-		g_rcv_state++;
-		return;
+}
+
+static void servicePorts() {
+	byte i;
+	// The senders go first, so that the bit edges don't jitter
+	for(i=0; i<g_num_ports; ++i) {
+		if (g_ports[i].snd_state != SND_IDLE) {
+			sendTick(&g_ports[i]);
+		}
 	}
-	if (g_rcv_state == PARITY_BIT_1HALF) {
-		if (!!digitalRead(g_rx_pin) == !!g_parity) {
-			// Parity mismatch - invert bits so that receiver will notice
-			g_cb = !g_cb;
+	for(i=0; i<g_num_ports; ++i) {
+		// The transceiver doesn't receive while it's sending
+		if (g_ports[i].snd_state == SND_IDLE) {
+			receiveTick(&g_ports[i]);
 		}
-		g_rcv_state++;
-		return;
 	}
-	if (g_rcv_state == PARITY_BIT_2HALF) {
-		g_rcv_state++;
-		return;
+}
+#else
+// A copy of the tick functions for each port, with the pin numbers and the
+// port state addresses known at compile time
+#define SST_SUFFIX _0
+#define SST_TX_PIN SOFT_SERIAL_TX_PIN_0
+#define SST_RX_PIN SOFT_SERIAL_RX_PIN_0
+#define SST_DIR_PIN SOFT_SERIAL_DIR_PIN_0
+#include "OddSoftSerTicks.h"
+#undef SST_SUFFIX
+#undef SST_TX_PIN
+#undef SST_RX_PIN
+#undef SST_DIR_PIN
+#if SOFT_SERIAL_PORTS > 1
+#define SST_SUFFIX _1
+#define SST_TX_PIN SOFT_SERIAL_TX_PIN_1
+#define SST_RX_PIN SOFT_SERIAL_RX_PIN_1
+#define SST_DIR_PIN SOFT_SERIAL_DIR_PIN_1
+#include "OddSoftSerTicks.h"
+#undef SST_SUFFIX
+#undef SST_TX_PIN
+#undef SST_RX_PIN
+#undef SST_DIR_PIN
+#endif
+#if SOFT_SERIAL_PORTS > 2
+#error "Add the pins and the tick functions of the other ports"
+#endif
+
+static void detectStartBits() {
+	detectStartBit_0(&g_ports[0]);
+#if SOFT_SERIAL_PORTS > 1
+	if (g_num_ports > 1) {
+		detectStartBit_1(&g_ports[1]);
 	}
-	if (g_rcv_state == STOP_BIT_1HALF) {
-		g_rcv_buff[g_write_pos] = g_cb;
-		g_rcv_state++;
-		return;
+#endif
+}
+
+static void servicePorts() {
+	// The senders go first, so that the bit edges don't jitter
+	if (g_ports[0].snd_state != SND_IDLE) {
+		sendTick_0(&g_ports[0]);
 	}
-	if (g_rcv_state == STOP_BIT_2HALF) {
-		g_write_pos++;
-		g_write_pos &= (MAX_RCV_BUFFER - 1);
-		g_rcv_state = 0;
-		return;
+#if SOFT_SERIAL_PORTS > 1
+	if (g_num_ports > 1 && g_ports[1].snd_state != SND_IDLE) {
+		sendTick_1(&g_ports[1]);
+	}
+#endif
+	// The transceiver doesn't receive while it's sending
+	if (g_ports[0].snd_state == SND_IDLE) {
+		receiveTick_0(&g_ports[0]);
 	}
-	if (!(g_rcv_state & 0x01)) {
-		g_cb >>= 1;
-		if (digitalRead(g_rx_pin)) {
-			g_cb |= 0x80;
-			g_parity = !g_parity;
+#if SOFT_SERIAL_PORTS > 1
+	if (g_num_ports > 1 && g_ports[1].snd_state == SND_IDLE) {
+		receiveTick_1(&g_ports[1]);
+	}
+#endif
+}
+#endif
+
+// Since we can't really access the software serial instances, the interrupt
+// handler works on the global port states.
+void softserial_gpt_handler() {
+	if (!g_ports_busy) {
+		// The lines are idle, which is most of the time. Only look for the
+		// start bits, without going through the state machines.
+		detectStartBits();
+		if (g_ports_busy) {
+			g_idle_ticks = 0;
+			g_lines_idle = 0;
+		} else if (g_idle_ticks < SOFT_SERIAL_IDLE_TICKS) {
+			g_idle_ticks++;
+		} else {
+			g_lines_idle = 1;
 		}
+		return;
 	}
-	g_rcv_state++;
+	g_idle_ticks = 0;
+	g_lines_idle = 0;
+	servicePorts();
 }
 
 #pragma clang diagnostic pop
 
+bool softSerialBusy() {
+	return g_ports_busy != 0;
+}
+
+static void startTimer() {
+	if (!g_gpt_running) {
+		g_idle_ticks = 0;
+		g_lines_idle = 0;
+		g_gpt_running = 1;
+		zunoGPTEnable(1);
+	}
+}
+
+void softSerialSleep() {
+	if (g_gpt_running && !g_listening && g_lines_idle && !g_ports_busy) {
+		zunoGPTEnable(0);
+		g_gpt_running = 0;
+	}
+}
+
+// The handler services SOFT_SERIAL_PORTS ports, the instances past them
+// get NO_PORT and do nothing
+static byte allocPort(s_pin tx_pin, s_pin rx_pin, s_pin dir_pin) {
+	if (g_num_ports >= SOFT_SERIAL_PORTS) {
+		return NO_PORT;
+	}
+	byte n = g_num_ports++;
+	g_ports[n].tx_pin = tx_pin;
+	g_ports[n].rx_pin = rx_pin;
+	g_ports[n].dir_pin = dir_pin;
+	return n;
+}
+
 OddSoftSer::OddSoftSer(s_pin tx_pin, s_pin rx_pin) {
-	m_tx_pin = tx_pin;
-	g_rx_pin = rx_pin;
+	m_port = allocPort(tx_pin, rx_pin, SOFT_SERIAL_DIR_PIN_0);
 }
 
-void OddSoftSer::begin(word baud) {
-	// Pin 2 controls the send/receive mode
-	pinMode(DIRECTION_CONTROL_PIN, OUTPUT);
-	digitalWrite(DIRECTION_CONTROL_PIN, LOW);
+OddSoftSer::OddSoftSer(s_pin tx_pin, s_pin rx_pin, s_pin dir_pin) {
+	m_port = allocPort(tx_pin, rx_pin, dir_pin);
+}
 
-	// Set up the timer interrupt for reading
-	dword ticks = 4000000L; // Each tick is a 0.25uS
-	ticks /= (baud * 2);
+#ifndef SOFT_SERIAL_RUNTIME_PINS
+// Whether the pins given to the port are the compile-time ones that the
+// interrupt handler uses
+static bool compiledPins(byte n, SoftSerPort *port) {
+	if (n == 0) {
+		return port->tx_pin == SOFT_SERIAL_TX_PIN_0 && port->rx_pin == SOFT_SERIAL_RX_PIN_0 &&
+			port->dir_pin == SOFT_SERIAL_DIR_PIN_0;
+	}
+	return n == 1 && port->tx_pin == SOFT_SERIAL_TX_PIN_1 &&
+		port->rx_pin == SOFT_SERIAL_RX_PIN_1 && port->dir_pin == SOFT_SERIAL_DIR_PIN_1;
+}
+#endif
+
+void OddSoftSer::begin() {
+	if (m_port == NO_PORT) {
+		Serial.println("OddSoftSer: more than SOFT_SERIAL_PORTS ports");
+		return;
+	}
+	SoftSerPort *port = &g_ports[m_port];
+#ifndef SOFT_SERIAL_RUNTIME_PINS
+	// The port would drive and sample other pins than it was given, leave
+	// it unusable rather than talk to the wrong bus
+	if (!compiledPins(m_port, port)) {
+		Serial.print("OddSoftSer: the pins of port "); Serial.print(m_port);
+		Serial.println(" don't match SOFT_SERIAL_*_PIN");
+		m_port = NO_PORT;
+		return;
+	}
+#endif
+	// The direction pin controls the send/receive mode
+	pinMode(port->dir_pin, OUTPUT);
+	digitalWrite(port->dir_pin, LOW);
+
+	pinMode(port->rx_pin, INPUT_PULLUP);
+	pinMode(port->tx_pin, OUTPUT);
+	digitalWrite(port->tx_pin, HIGH);
+
+	// Set up the timer interrupt for reading and writing, all the ports
+	// share it
 	zunoGPTEnable(0);
-	pinMode(g_rx_pin, INPUT_PULLUP);
 	zunoGPTInit(ZUNO_GPT_CYCLIC | ZUNO_GPT_IMWRITE);
-	zunoGPTSet(word(ticks));
-	zunoGPTEnable(1);
+	zunoGPTSet(SOFT_SERIAL_GPT_TICKS);
+	g_gpt_running = 0;
+	startTimer();
+}
 
-	// Set up the output pin for writing
-	ticks = 1000000L; // uS
-	ticks /= baud;
-	bit_time = ticks;
-	bit_time -= CONST_USECONDS_OFFSET;
-	pinMode(m_tx_pin, OUTPUT);
-	digitalWrite(m_tx_pin, HIGH);
+void OddSoftSer::listen(bool always) {
+	if (m_port == NO_PORT) {
+		return;
+	}
+	if (always) {
+		g_listening |= 1 << m_port;
+		startTimer();
+	} else {
+		g_listening &= ~(1 << m_port);
+	}
 }
 
 uint8_t OddSoftSer::available(void) {
+	if (m_port == NO_PORT) {
+		return 0;
+	}
+	SoftSerPort *port = &g_ports[m_port];
 	uint8_t res;
-	if (g_write_pos < g_read_pos)
-		res = (MAX_RCV_BUFFER - g_read_pos) + g_write_pos;
+	if (port->write_pos < port->read_pos)
+		res = (MAX_RCV_BUFFER - port->read_pos) + port->write_pos;
 	else
-		res = g_write_pos - g_read_pos;
+		res = port->write_pos - port->read_pos;
 	return res;
 }
 
 // Drain the read buffer
 void OddSoftSer::drain() {
-	g_read_pos = g_write_pos;
+	if (m_port == NO_PORT) {
+		return;
+	}
+	g_ports[m_port].read_pos = g_ports[m_port].write_pos;
 }
 
 int OddSoftSer::peek(void) {
-	return g_rcv_buff[g_read_pos];
+	if (m_port == NO_PORT) {
+		return -1;
+	}
+	return g_ports[m_port].rcv_buff[g_ports[m_port].read_pos];
 }
 
 uint8_t OddSoftSer::read(void) {
-	byte val = g_rcv_buff[g_read_pos];
+	if (m_port == NO_PORT) {
+		return 0;
+	}
+	SoftSerPort *port = &g_ports[m_port];
+	byte val = port->rcv_buff[port->read_pos];
 	// We use cyclic buffer here
-	g_read_pos++;
-	g_read_pos &= (MAX_RCV_BUFFER - 1);
+	port->read_pos++;
+	port->read_pos &= (MAX_RCV_BUFFER - 1);
 	return val;
 }
 
+// A millisecond of a wait for the interrupt handler. The handler may never
+// get there if the timer has stopped, so the hook gets a chance to notice.
+static void softSerialWait() {
+	delay(1);
+	if (g_soft_serial_wait) {
+		g_soft_serial_wait();
+	}
+}
+
+bool OddSoftSer::sending() {
+	return m_port != NO_PORT && g_ports[m_port].snd_state != SND_IDLE;
+}
+
 void OddSoftSer::flush(void) {
+	while(sending()) {
+		softSerialWait();
+	}
 }
 
 void OddSoftSer::write(uint8_t d) {
-	byte i = 8;
-    // Set the send mode
-    digitalWrite(DIRECTION_CONTROL_PIN, HIGH);
-
-    noInterrupts_F();
-    // to be shure that timing is right
-    sysClockSet(SYSCLOCK_NORMAL);
-
-	// Start Bit
-	digitalWrite(m_tx_pin, 0);
-	delayMicroseconds(bit_time);
-	delayMicroseconds(4);
-	// Bit sequence from the LSB
-	bool parity = false;
-	while (i--) {
-		if (d & 0x01) {
-			digitalWrite(m_tx_pin, 1);
-			parity = !parity;
-		} else {
-			digitalWrite(m_tx_pin, 0);
-		}
-		d >>= 1;
-		delayMicroseconds(bit_time);
-		delayMicroseconds(3);
+	if (m_port == NO_PORT) {
+		return;
 	}
+	SoftSerPort *port = &g_ports[m_port];
+	byte next = (port->snd_write_pos + 1) & (MAX_SND_BUFFER - 1);
+	while(next == port->snd_read_pos) {
+		// The buffer is full, wait for the interrupt handler to send a byte
+		softSerialWait();
+	}
+	port->snd_buff[port->snd_write_pos] = d;
+	port->snd_write_pos = next;
 
-	digitalWrite(m_tx_pin, parity?0:1);
-	delayMicroseconds(bit_time);
-	delayMicroseconds(4);
-
-	// Stop Bit
-	digitalWrite(m_tx_pin, 1);
-	delayMicroseconds(bit_time);
-	delayMicroseconds(4);
-
-    // revert back system frequency
-    sysClockNormallize();
-    interrupts_F();
+	// The handler checks the buffer before going idle, so it either picks up
+	// the byte or it's idle by now. The handler also changes the busy count
+	// when a reception ends, and the increment isn't atomic on the 8051.
+	noInterrupts_F();
+	byte start = port->snd_state == SND_IDLE;
+	if (start) {
+		// Set the send mode, the start bit goes out on the next tick
+		digitalWrite(port->dir_pin, HIGH);
+		g_ports_busy++;
+		port->snd_state = SND_START_BIT;
+		// The handler may have just found the lines idle, the main loop
+		// mustn't stop the running timer before it sends the frame
+		g_idle_ticks = 0;
+		g_lines_idle = 0;
+	}
+	interrupts_F();
+	if (start) {
+		startTimer();
+	}
+}
 
-    // Set the receive mode back
-    digitalWrite(DIRECTION_CONTROL_PIN, LOW);
+word OddSoftSer::parityErrors() {
+	return m_port == NO_PORT ? 0 : g_ports[m_port].parity_errors;
 }
 
-s_pin g_rx_pin = 12;
-byte g_rcv_state = 0;
-byte g_cb;
-byte g_rcv_buff[MAX_RCV_BUFFER];
-byte g_write_pos = 0;
-byte g_read_pos = 0;
-byte g_parity = 0;
+word OddSoftSer::framingErrors() {
+	return m_port == NO_PORT ? 0 : g_ports[m_port].framing_errors;
+}
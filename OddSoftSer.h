@@ -2,22 +2,115 @@
 
 #include "Stream.h"
 
-#define MAX_RCV_BUFFER 128 // !!! HAVE to be 2^n
+// The number of ports the timer interrupt can service
+#define SOFT_SERIAL_PORTS 2
+#define MAX_RCV_BUFFER 64 // !!! HAVE to be 2^n
+#define MAX_SND_BUFFER 32 // !!! HAVE to be 2^n
+// The timer keeps running for this long after the last activity on the
+// lines, long enough for the motors to start their replies
+#define SOFT_SERIAL_LISTEN_MS 50
+
+// All the ports share the baud rate, the timer runs at twice of it. The
+// timer ticks are 0.25 us.
+#define SOFT_SERIAL_BAUD 4800
+#define SOFT_SERIAL_GPT_TICKS word(4000000L / (SOFT_SERIAL_BAUD * 2L))
+#define SOFT_SERIAL_IDLE_TICKS word(SOFT_SERIAL_BAUD * 2L * SOFT_SERIAL_LISTEN_MS / 1000)
+
+// The pins of the ports, in the order the ports are constructed. The
+// interrupt handler uses these compile-time pin numbers, which the compiler
+// turns into direct port operations, instead of the pins passed to the
+// constructors. Pass these definitions to the constructors: begin() prints
+// an error on the debug serial and leaves the port unusable if the pins
+// differ. Define SOFT_SERIAL_RUNTIME_PINS to use the constructor pins.
+#define SOFT_SERIAL_TX_PIN_0 16
+#define SOFT_SERIAL_RX_PIN_0 15
+#define SOFT_SERIAL_DIR_PIN_0 2
+#define SOFT_SERIAL_TX_PIN_1 4
+#define SOFT_SERIAL_RX_PIN_1 5
+#define SOFT_SERIAL_DIR_PIN_1 3
+
+#if SOFT_SERIAL_TX_PIN_0 == SOFT_SERIAL_RX_PIN_0 || \
+	SOFT_SERIAL_TX_PIN_0 == SOFT_SERIAL_DIR_PIN_0 || \
+	SOFT_SERIAL_RX_PIN_0 == SOFT_SERIAL_DIR_PIN_0
+#error "The pins of the soft serial port 0 must differ"
+#endif
+#if SOFT_SERIAL_PORTS > 1
+#if SOFT_SERIAL_TX_PIN_1 == SOFT_SERIAL_RX_PIN_1 || \
+	SOFT_SERIAL_TX_PIN_1 == SOFT_SERIAL_DIR_PIN_1 || \
+	SOFT_SERIAL_RX_PIN_1 == SOFT_SERIAL_DIR_PIN_1
+#error "The pins of the soft serial port 1 must differ"
+#endif
+#if SOFT_SERIAL_TX_PIN_1 == SOFT_SERIAL_TX_PIN_0 || \
+	SOFT_SERIAL_TX_PIN_1 == SOFT_SERIAL_RX_PIN_0 || \
+	SOFT_SERIAL_TX_PIN_1 == SOFT_SERIAL_DIR_PIN_0 || \
+	SOFT_SERIAL_RX_PIN_1 == SOFT_SERIAL_TX_PIN_0 || \
+	SOFT_SERIAL_RX_PIN_1 == SOFT_SERIAL_RX_PIN_0 || \
+	SOFT_SERIAL_RX_PIN_1 == SOFT_SERIAL_DIR_PIN_0 || \
+	SOFT_SERIAL_DIR_PIN_1 == SOFT_SERIAL_TX_PIN_0 || \
+	SOFT_SERIAL_DIR_PIN_1 == SOFT_SERIAL_RX_PIN_0 || \
+	SOFT_SERIAL_DIR_PIN_1 == SOFT_SERIAL_DIR_PIN_0
+#error "The soft serial ports 0 and 1 share a pin"
+#endif
+#endif
+
+// The port number of the instances past SOFT_SERIAL_PORTS, they don't
+// send or receive anything
+#define NO_PORT SOFT_SERIAL_PORTS
+
+// The state of a port, shared with the interrupt handler
+struct SoftSerPort {
+	s_pin tx_pin, rx_pin, dir_pin;
+
+	// Receiver
+	byte rcv_state;
+	byte cb;
+	byte parity;
+	byte rcv_buff[MAX_RCV_BUFFER];
+	byte write_pos, read_pos;
+	word parity_errors, framing_errors;
+
+	// Transmitter, snd_state is 0 when the port is idle
+	byte snd_state;
+	byte snd_byte;
+	byte snd_parity;
+	byte snd_buff[MAX_SND_BUFFER];
+	byte snd_write_pos, snd_read_pos;
+};
+
+extern SoftSerPort g_ports[SOFT_SERIAL_PORTS];
+extern byte g_num_ports;
+
+void softserial_gpt_handler();
+// True if any port is sending or is in the middle of receiving a byte
+bool softSerialBusy();
+// Stop the timer interrupt if the lines have been idle for
+// SOFT_SERIAL_LISTEN_MS, no port is sending and no port listens all the
+// time. Called from the main loop, write() starts the timer again.
+void softSerialSleep();
+// Called on every millisecond that flush() or write() waits for the
+// interrupt handler, these waits don't end if the timer has stopped. Null
+// by default, the sketch can point it to its watchdog check.
+extern void (*g_soft_serial_wait)();
 
 // Bit-banged software serial port with negative parity support.
-// It uses global variables under the hood, so only one instance of this class
-// can exist.
+// All the ports are serviced by a single timer interrupt at twice the baud
+// rate, both for receiving and sending, so they share the baud rate. Up to
+// SOFT_SERIAL_PORTS instances can be used, their pins must match the
+// SOFT_SERIAL_*_PIN_n definitions unless SOFT_SERIAL_RUNTIME_PINS is defined.
+// The instances past SOFT_SERIAL_PORTS do nothing.
 class OddSoftSer : public Stream
 {
 private:
-	word bit_time;
-	s_pin m_tx_pin;
+	byte m_port;
 
 public:
-	// Duplex version (TX&RX)
+	// Duplex version (TX&RX), the direction of the RS-485 transceiver is
+	// controlled by SOFT_SERIAL_DIR_PIN_0
 	OddSoftSer(s_pin tx_pin, s_pin rx_pin);
+	OddSoftSer(s_pin tx_pin, s_pin rx_pin, s_pin dir_pin);
 
-	void begin(word baud);
+	// Start the port at SOFT_SERIAL_BAUD
+	void begin();
 
 	virtual uint8_t available(void);
 
@@ -25,10 +118,22 @@ public:
 
 	virtual uint8_t read(void);
 
+	// Wait until everything has been sent
 	virtual void flush(void);
 
+	// Queue the byte for sending, waits only if the send buffer is full
 	virtual void write(uint8_t);
 
 	// Clear the input buffer
 	void drain();
+
+	// True while there are bytes to send
+	bool sending();
+
+	// Keep sampling the idle line, to hear the frames that aren't replies to
+	// our own. Otherwise the line is only sampled for a while after sending.
+	void listen(bool always);
+
+	word parityErrors();
+	word framingErrors();
 };
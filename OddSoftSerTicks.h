@@ -0,0 +1,117 @@
+// The per-tick work of a soft serial port, included by OddSoftSer.cpp once
+// for each port. The includer defines SST_SUFFIX for the function names and
+// SST_TX_PIN, SST_RX_PIN and SST_DIR_PIN, either as the pin fields of the
+// port or as the compile-time pin numbers. No include guard on purpose.
+//
+// The states are dispatched with a switch over dense values, which the
+// compiler turns into a jump table instead of a chain of comparisons.
+
+#define SST_CAT2(a, b) a##b
+#define SST_CAT(a, b) SST_CAT2(a, b)
+#define SST_FN(name) SST_CAT(name, SST_SUFFIX)
+
+// Put the next bit of the byte being sent on the line
+static void SST_FN(sendTick)(SoftSerPort *port) {
+	byte state = port->snd_state;
+	switch(state) {
+	case SND_BYTE_DONE:
+		if (port->snd_read_pos == port->snd_write_pos) {
+			// Everything has been sent, set the receive mode back
+			digitalWrite(SST_DIR_PIN, LOW);
+			port->snd_state = SND_IDLE;
+			g_ports_busy--;
+			return;
+		}
+		// Go on with the next byte
+		// fall through
+	case SND_START_BIT:
+		port->snd_byte = port->snd_buff[port->snd_read_pos];
+		port->snd_read_pos++;
+		port->snd_read_pos &= (MAX_SND_BUFFER - 1);
+		port->snd_parity = 0;
+		digitalWrite(SST_TX_PIN, 0);
+		state = SND_START_BIT;
+		break;
+
+	case 3: case 5: case 7: case 9: case 11: case 13: case 15: case 17:
+		// Bit sequence from the LSB
+		if (port->snd_byte & 0x01) {
+			digitalWrite(SST_TX_PIN, 1);
+			port->snd_parity = !port->snd_parity;
+		} else {
+			digitalWrite(SST_TX_PIN, 0);
+		}
+		port->snd_byte >>= 1;
+		break;
+
+	case SND_PARITY_BIT:
+		digitalWrite(SST_TX_PIN, port->snd_parity ? 0 : 1);
+		break;
+
+	case SND_STOP_BIT:
+		digitalWrite(SST_TX_PIN, 1);
+		break;
+
+	default:
+		// The middle of a bit
+		break;
+	}
+	port->snd_state = state + 1;
+}
+
+// The falling edge of a start bit, the byte is sampled from the next tick
+static void SST_FN(detectStartBit)(SoftSerPort *port) {
+	if (digitalRead(SST_RX_PIN)) {
+		return;
+	}
+	port->cb = 0;
+	port->parity = 0;
+	port->rcv_state = START_BIT_2HALF;
+	g_ports_busy++;
+}
+
+// Sample the line of a port that is receiving
+static void SST_FN(receiveTick)(SoftSerPort *port) {
+	switch(port->rcv_state) {
+	case START_BIT_1HALF:
+		SST_FN(detectStartBit)(port);
+		return;
+
+	case 2: case 4: case 6: case 8: case 10: case 12: case 14: case 16:
+		// The data bits, from the LSB
+		port->cb >>= 1;
+		if (digitalRead(SST_RX_PIN)) {
+			port->cb |= 0x80;
+			port->parity = !port->parity;
+		}
+		break;
+
+	case PARITY_BIT_1HALF:
+		if (!!digitalRead(SST_RX_PIN) == !!port->parity) {
+			// Parity mismatch - invert bits so that receiver will notice
+			port->cb = !port->cb;
+			port->parity_errors++;
+		}
+		break;
+
+	case STOP_BIT_1HALF:
+		if (!digitalRead(SST_RX_PIN)) {
+			// No stop bit, we're out of sync with the sender
+			port->framing_errors++;
+		}
+		port->rcv_buff[port->write_pos] = port->cb;
+		break;
+
+	case STOP_BIT_2HALF:
+		port->write_pos++;
+		port->write_pos &= (MAX_RCV_BUFFER - 1);
+		port->rcv_state = START_BIT_1HALF;
+		g_ports_busy--;
+		return;
+	}
+	port->rcv_state++;
+}
+
+#undef SST_FN
+#undef SST_CAT
+#undef SST_CAT2
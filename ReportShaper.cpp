@@ -0,0 +1,78 @@
+#include "ReportShaper.h"
+
+ReportStats g_report_stats;
+
+// Bit N - 1 is set if the report of the channel N is pending
+dword g_report_pending;
+byte g_report_tokens = REPORT_BUCKET_SIZE;
+dword g_report_refill_time, g_report_sent_time;
+
+void reportQueue(byte channel) {
+	dword bit = dword(1) << (channel - 1);
+	if (g_report_pending & bit) {
+		g_report_stats.merged++;
+		return;
+	}
+	g_report_pending |= bit;
+
+	byte depth = reportQueueDepth();
+	if (depth > g_report_stats.maxDepth) {
+		g_report_stats.maxDepth = depth;
+	}
+}
+
+void reportQueueRoutine(byte numChannels) {
+	for(byte ch=1; ch<=numChannels; ++ch) {
+		reportQueue(ch);
+	}
+}
+
+byte reportQueueDepth() {
+	byte depth = 0;
+	for(dword pending = g_report_pending; pending; pending >>= 1) {
+		depth += pending & 1;
+	}
+	return depth;
+}
+
+void reportShaperService() {
+	dword now = millis();
+	// Refill the bucket, a full bucket doesn't save up the time
+	while(g_report_tokens < REPORT_BUCKET_SIZE &&
+		now - g_report_refill_time >= REPORT_TOKEN_INTERVAL) {
+		g_report_tokens++;
+		g_report_refill_time += REPORT_TOKEN_INTERVAL;
+	}
+	if (g_report_tokens == REPORT_BUCKET_SIZE) {
+		g_report_refill_time = now;
+	}
+
+	if (!g_report_pending || !g_report_tokens ||
+		now - g_report_sent_time < REPORT_MIN_SPACING) {
+		return;
+	}
+
+	// The lowest channel first, so the group channel leads
+	byte ch = 1;
+	while(!(g_report_pending & (dword(1) << (ch - 1)))) {
+		ch++;
+	}
+	g_report_pending &= ~(dword(1) << (ch - 1));
+	g_report_tokens--;
+	g_report_sent_time = now;
+	g_report_stats.sent++;
+	zunoSendUncolicitedReport(ch);
+}
+
+void resetReportStats() {
+	g_report_stats.sent = 0;
+	g_report_stats.merged = 0;
+	g_report_stats.maxDepth = reportQueueDepth();
+}
+
+void dumpReportStats() {
+	Serial.print("Reports: queued "); Serial.print(reportQueueDepth());
+	Serial.print(" max "); Serial.print(g_report_stats.maxDepth);
+	Serial.print(" sent "); Serial.print(g_report_stats.sent);
+	Serial.print(" merged "); Serial.println(g_report_stats.merged);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Arduino.h"
+#include "Logic.h"
+
+// Shapes the unsolicited Z-Wave reports, so that a burst of state changes
+// doesn't congest the mesh. Reports wait in a per-channel pending mask, a
+// report for a channel that is already pending is merged into it. The
+// reports are sent from a token bucket: up to REPORT_BUCKET_SIZE in a burst,
+// then one per REPORT_TOKEN_INTERVAL, never closer than REPORT_MIN_SPACING.
+#define REPORT_BUCKET_SIZE 4
+#define REPORT_TOKEN_INTERVAL 500 // ms
+#define REPORT_MIN_SPACING 50 // ms
+
+// Channel 1 is the group, channels 2.. are the blinds
+#define REPORT_CHANNELS (MAX_BLINDS + 1)
+#if REPORT_CHANNELS > 32
+#error "The pending reports are a 32-bit mask"
+#endif
+
+struct ReportStats {
+	dword sent, merged;
+	byte maxDepth;
+};
+
+extern ReportStats g_report_stats;
+
+// Queue the report of the channel, it's sent when the bucket allows
+void reportQueue(byte channel);
+// Queue the routine report of the channels 1..numChannels. The channels
+// whose reports are still pending are merged, they carry the fresh values.
+void reportQueueRoutine(byte numChannels);
+byte reportQueueDepth();
+// Send out the pending reports that the bucket allows, call it often
+void reportShaperService();
+
+void resetReportStats();
+// Print the queue depth and the counters to the debug serial
+void dumpReportStats();
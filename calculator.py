@@ -106,7 +106,9 @@ DISCOVER_ALL = Message(0xBF, [0x80, 0x80, 0x80, 00, 00, 00])
 
 moveUp = True
 
-ser = serial.Serial('/dev/tty.usbserial-AC01QL0Z', 4800, timeout=1,
+# The RS-485 adapter, or the pty of emulator.py
+port = sys.argv[1] if len(sys.argv) > 1 else '/dev/tty.usbserial-AC01QL0Z'
+ser = serial.Serial(port, 4800, timeout=1,
                     parity=serial.PARITY_ODD)  # open serial port
 print("Discovering devices")
 
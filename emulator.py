@@ -0,0 +1,276 @@
+# Emulates a segment of Somfy motors on a pseudo-terminal, so the gateway's
+# host build and the tools can be run against many motors without the
+# hardware. The motors answer the discovery, report their positions and move
+# at their own speeds. Their replies are put on the line at the real byte
+# rate of 4800 baud, and replies that overlap collide like on RS-485: the
+# drivers fight and the bits where they differ come out at random.
+#
+# Usage: python3 emulator.py [-n 8] [--link /tmp/somfy] [--noise 0.001] [--drop 0.02]
+#
+# The emulator prints the path of the pty, open it like the serial adapter,
+# for example: python3 calculator.py /tmp/somfy
+# Ctrl-C prints the counters and exits.
+
+import argparse, os, random, select, signal, sys, termios, time, tty
+
+DISCOVER_ALL = 0xBF
+HERE_IS_MOTOR = 0x9F
+REPORT_MOTOR_STATUS = 0xF3
+HERE_IS_POSITION = 0xF2
+MOVE_MOTOR_TO_POS = 0xFC
+STOP_MOTOR = 0xFD
+
+# A start bit, 8 data bits, the parity bit and a stop bit
+BYTE_TIME = 11.0 / 4800
+# A pause this long inside a request drops the bytes received so far
+FRAME_GAP = 0.02
+
+
+def checksum(data):
+    s = sum(data)
+    return [(s // 256) & 0xFF, s % 256]
+
+
+def frame(msgid, payload):
+    res = [msgid, 0xFF - len(payload) - 4] + payload
+    return res + checksum(res)
+
+
+class Motor(object):
+    def __init__(self, rnd, addr, args):
+        # The address as it is on the wire
+        self.addr = addr
+        self.speed = rnd.uniform(args.min_speed, args.max_speed)  # % per second
+        # The ticks go up or down with the position depending on the mounting
+        self.ticks_per_pct = rnd.choice([-1, 1]) * rnd.randint(80, 150)
+        self.ticks_base = rnd.randint(15000, 50000)
+        self.pos = float(rnd.randint(0, 100))
+        self.target = self.pos
+        self.start_at = 0.0
+        self.updated_at = 0.0
+        self.moving = False
+
+    def advance(self, now):
+        if not self.moving or now <= self.start_at:
+            return
+        step = self.speed * (now - max(self.updated_at, self.start_at))
+        left = abs(self.target - self.pos)
+        if step >= left:
+            self.pos = self.target
+            self.moving = False
+        else:
+            self.pos += step if self.target > self.pos else -step
+        self.updated_at = now
+
+    def move(self, now, target, start_delay):
+        self.advance(now)
+        self.target = float(target)
+        if not self.moving and self.target != self.pos:
+            self.moving = True
+            self.start_at = now + start_delay
+            self.updated_at = self.start_at
+
+    def stop(self, now):
+        self.advance(now)
+        self.target = self.pos
+        self.moving = False
+
+    def here_is_motor(self):
+        return frame(HERE_IS_MOTOR, [0xFF] + self.addr)
+
+    def here_is_position(self, now):
+        self.advance(now)
+        ticks = int(self.ticks_base + self.pos * self.ticks_per_pct) & 0xFFFF
+        return frame(HERE_IS_POSITION, [0xFF] + self.addr + [0x80, 0x80, 0x80,
+            ticks % 256, ticks // 256, 0xFF - int(self.pos), 0x00])
+
+
+class Line(object):
+    """The bytes that the motors put on the line, in the byte slots of the
+    wire time. Where the transmissions that meet in a slot differ, the byte
+    is garbled."""
+
+    def __init__(self, noise, rnd):
+        self.slots = {}
+        self.noise = noise
+        self.rnd = rnd
+        self.collisions = 0
+
+    def transmit(self, at, data):
+        first = int(at / BYTE_TIME) + 1
+        collided = False
+        for k, b in enumerate(data):
+            slot = first + k
+            if slot in self.slots:
+                diff = self.slots[slot] ^ b
+                self.slots[slot] = (b & ~diff) | (self.rnd.randint(0, 255) & diff)
+                collided = True
+            else:
+                self.slots[slot] = b
+        if collided:
+            self.collisions += 1
+
+    def next_time(self):
+        if not self.slots:
+            return None
+        return min(self.slots) * BYTE_TIME
+
+    def take(self, now):
+        """The bytes whose slots have ended"""
+        last = int(now / BYTE_TIME)
+        ready = sorted(s for s in self.slots if s <= last)
+        return bytes(corrupt(self.slots.pop(s), self.noise, self.rnd) for s in ready)
+
+
+def corrupt(b, noise, rnd):
+    for bit in range(8):
+        if noise and rnd.random() < noise:
+            b ^= 1 << bit
+    return b
+
+
+class Segment(object):
+    def __init__(self, args):
+        self.args = args
+        self.rnd = random.Random(args.seed)
+        self.line = Line(args.noise, self.rnd)
+        self.motors = {}
+        while len(self.motors) < args.motors:
+            addr = [self.rnd.randint(0, 255) for _ in range(3)]
+            self.motors[tuple(addr)] = Motor(self.rnd, addr, args)
+        self.rx = []
+        self.rx_at = 0.0
+        self.counters = dict(requests=0, bad=0, dropped=0, replies=0)
+
+    def latency(self):
+        return self.rnd.uniform(self.args.min_latency, self.args.max_latency) / 1000.0
+
+    def receive(self, data, now):
+        if self.rx and now - self.rx_at > FRAME_GAP:
+            self.counters["bad"] += 1
+            self.rx = []
+        self.rx_at = now
+        for b in data:
+            self.rx.append(corrupt(b, self.args.noise, self.rnd))
+            if len(self.rx) >= 2 and len(self.rx) == 0xFF - self.rx[1]:
+                self.handle(self.rx, now)
+                self.rx = []
+            elif len(self.rx) >= 2 and not 5 <= 0xFF - self.rx[1] <= 64:
+                # Not a frame start, resync on the next byte
+                self.counters["bad"] += 1
+                self.rx = self.rx[1:]
+
+    def handle(self, data, now):
+        if checksum(data[:-2]) != data[-2:]:
+            self.counters["bad"] += 1
+            return
+        self.counters["requests"] += 1
+        if self.rnd.random() < self.args.drop:
+            self.counters["dropped"] += 1
+            return
+        msgid = data[0]
+        dest = tuple(data[6:9])
+        if msgid == DISCOVER_ALL:
+            for m in self.motors.values():
+                self.reply(now + self.latency() + self.rnd.uniform(0, self.args.spread / 1000.0),
+                    m.here_is_motor())
+            return
+        if msgid == STOP_MOTOR and dest == (0, 0, 0):
+            for m in self.motors.values():
+                m.stop(now)
+            return
+        m = self.motors.get(dest)
+        if m is None:
+            return
+        if msgid == REPORT_MOTOR_STATUS:
+            at = now + self.latency()
+            self.reply(at, m.here_is_position(at))
+        elif msgid == STOP_MOTOR:
+            m.stop(now)
+        elif msgid == MOVE_MOTOR_TO_POS and len(data) >= 13:
+            if data[9] == 0xFB:
+                target = min(100, 0xFF - data[10])
+            else:
+                target = 0 if data[9] == 0xFE else 100
+            m.move(now, target, self.args.start_delay / 1000.0)
+
+    def reply(self, at, data):
+        self.counters["replies"] += 1
+        self.line.transmit(at, data)
+
+    def report(self, started):
+        c = self.counters
+        print("%.0f s: %d requests, %d bad, %d dropped, %d replies, %d collided" % (
+            time.monotonic() - started, c["requests"], c["bad"], c["dropped"], c["replies"],
+            self.line.collisions))
+        for m in sorted(self.motors.values(), key=lambda m: m.addr):
+            m.advance(time.monotonic() - started)
+            print("  %02X%02X%02X %5.1f%% %4.1f %%/s%s" % (m.addr[0], m.addr[1], m.addr[2],
+                m.pos, m.speed, " moving" if m.moving else ""))
+
+
+def open_pty(link):
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    attrs = termios.tcgetattr(slave)
+    attrs[2] |= termios.PARENB | termios.PARODD
+    attrs[4] = attrs[5] = termios.B4800
+    termios.tcsetattr(slave, termios.TCSANOW, attrs)
+    path = os.ttyname(slave)
+    if link:
+        if os.path.islink(link):
+            os.unlink(link)
+        os.symlink(path, link)
+    # The slave stays open, so the pty outlives the clients
+    return master, slave, path
+
+
+def run(args):
+    master, slave, path = open_pty(args.link)
+    segment = Segment(args)
+    print("%d motors on %s%s" % (args.motors, path, " (%s)" % args.link if args.link else ""))
+    sys.stdout.flush()
+    started = time.monotonic()
+    last_report = started
+    signal.signal(signal.SIGTERM, lambda *a: sys.exit(0))
+    try:
+        while True:
+            now = time.monotonic() - started
+            wake = segment.line.next_time()
+            timeout = 0.5 if wake is None else max(0.0, wake + BYTE_TIME - now)
+            readable, _, _ = select.select([master], [], [], min(timeout, 0.5))
+            now = time.monotonic() - started
+            if readable:
+                segment.receive(os.read(master, 256), now)
+            out = segment.line.take(now)
+            if out:
+                os.write(master, out)
+            if args.stats and time.monotonic() - last_report >= args.stats:
+                last_report = time.monotonic()
+                segment.report(started)
+    except (KeyboardInterrupt, SystemExit):
+        pass
+    finally:
+        segment.report(started)
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+        os.close(slave)
+        os.close(master)
+
+
+if __name__ == "__main__":
+    p = argparse.ArgumentParser(description="Somfy motors on a pseudo-terminal")
+    p.add_argument("-n", "--motors", type=int, default=4)
+    p.add_argument("--link", help="a symlink to the pty, e.g. /tmp/somfy")
+    p.add_argument("--seed", type=int, default=1, help="the motors and the noise")
+    p.add_argument("--min-speed", type=float, default=2.0, help="% per second")
+    p.add_argument("--max-speed", type=float, default=6.5, help="% per second")
+    p.add_argument("--min-latency", type=float, default=3, help="ms before a reply")
+    p.add_argument("--max-latency", type=float, default=12, help="ms before a reply")
+    p.add_argument("--spread", type=float, default=60,
+        help="ms over which the motors answer a discovery")
+    p.add_argument("--start-delay", type=float, default=200, help="ms before a motor starts")
+    p.add_argument("--noise", type=float, default=0.0, help="probability of a flipped bit")
+    p.add_argument("--drop", type=float, default=0.0, help="probability of an ignored request")
+    p.add_argument("--stats", type=float, default=0, help="print the counters every N s")
+    run(p.parse_args())
@@ -0,0 +1,161 @@
+#pragma once
+
+// Stand-in for the Z-Uno core, used to build the gateway logic on a
+// development machine. Time comes from the virtual clock, pins, the
+// Z-Wave channels and the peripherals are plain variables that the
+// simulations can inspect and drive.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef uint32_t dword;
+typedef uint32_t DWORD;
+typedef uint8_t s_pin;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+// Return by value, like the macros of the Z-Uno core
+template<typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) {
+	return a < b ? a : b;
+}
+
+template<typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) {
+	return a > b ? a : b;
+}
+
+// Time
+dword millis();
+dword micros();
+void delay(dword ms);
+void delayMicroseconds(word us);
+
+// Pins
+#define HOST_NUM_PINS 32
+extern byte g_host_pin_level[HOST_NUM_PINS];
+extern byte g_host_pin_mode[HOST_NUM_PINS];
+// Called on every digitalWrite(), e.g. to capture the output waveforms
+extern void (*g_host_pin_observer)(byte pin, byte value);
+// Simulated duration of a digitalWrite() call, in microseconds
+extern word g_host_digital_write_us;
+// The number of digitalRead() and digitalWrite() calls
+extern dword g_host_pin_reads, g_host_pin_writes;
+void pinMode(byte pin, byte mode);
+void digitalWrite(byte pin, byte value);
+byte digitalRead(byte pin);
+
+// CPU
+#define SYSCLOCK_NORMAL 0
+void noInterrupts_F();
+void interrupts_F();
+void sysClockSet(byte mode);
+void sysClockNormallize();
+
+// General purpose timer. delay() and delayMicroseconds() run the handler on
+// the timer ticks while the soft serial ports are busy. The idle ticks are
+// skipped: the simulations inject the received bytes directly, or call the
+// handler themselves to drive the receiver bit by bit. With
+// g_host_gpt_all_ticks set the handler runs on every tick while the timer
+// is enabled, and its calls, pin accesses and host time are counted.
+#define ZUNO_GPT_CYCLIC 0x01
+#define ZUNO_GPT_IMWRITE 0x02
+byte hostSetGptHandler(void (*handler)());
+#define ZUNO_SETUP_ISR_GPTIMER(handler) static byte g_host_gpt_handler_set = hostSetGptHandler(handler)
+extern byte g_host_gpt_enabled;
+extern word g_host_gpt_period;
+extern byte g_host_gpt_all_ticks;
+extern dword g_host_gpt_calls, g_host_gpt_pin_ops;
+extern double g_host_gpt_ns;
+void zunoGPTInit(byte flags);
+void zunoGPTSet(word period);
+void zunoGPTEnable(byte enable);
+
+// Z-Wave
+#define ZUNO_MAX_CHANNELS 32
+#define ZUNO_BLINDS_CHANNEL_NUMBER 0x10
+struct ZUNOChannelData {
+	byte bParam;
+};
+extern ZUNOChannelData g_channels_data[ZUNO_MAX_CHANNELS];
+// Set by the simulation to emulate the hub writing to a channel (1-based)
+extern byte g_host_channel_updated[ZUNO_MAX_CHANNELS + 1];
+extern dword g_host_reports_sent[ZUNO_MAX_CHANNELS + 1];
+extern byte g_host_num_channels;
+extern bool g_host_in_network;
+extern bool g_host_reboot_requested;
+extern dword g_host_learn_started;
+extern word g_host_cfg_params[256];
+
+bool zunoIsChannelUpdated(byte channel);
+void zunoSendUncolicitedReport(byte channel);
+bool zunoInNetwork();
+void zunoStartLearn(byte timeout, byte secure);
+void zunoReboot();
+void zunoSaveCFGParam(byte param, word value);
+word zunoLoadCFGParam(byte param);
+
+void hostStartConfig();
+void hostAddChannel(byte type);
+#define ZUNO_START_CONFIG() hostStartConfig()
+#define ZUNO_SET_ZWCHANNEL(channel)
+#define ZUNO_ADD_CHANNEL(type, p1, p2) hostAddChannel(type);
+#define ZUNO_COMMIT_CONFIG()
+
+// Text output
+class Print {
+public:
+	virtual ~Print() {}
+	virtual void write(uint8_t value) = 0;
+
+	void print(const char *str);
+	void print(char c);
+	void print(unsigned char num, int base = DEC);
+	void print(int num, int base = DEC);
+	void print(unsigned int num, int base = DEC);
+	void print(long num, int base = DEC);
+	void print(unsigned long num, int base = DEC);
+
+	void println();
+	void println(const char *str);
+	void println(char c);
+	void println(unsigned char num, int base = DEC);
+	void println(int num, int base = DEC);
+	void println(unsigned int num, int base = DEC);
+	void println(long num, int base = DEC);
+	void println(unsigned long num, int base = DEC);
+
+private:
+	void printNumber(unsigned long num, int base);
+};
+
+// The debug serial port
+class HostSerial : public Print {
+public:
+	void begin(dword baud);
+	uint8_t available();
+	uint8_t read();
+	virtual void write(uint8_t value);
+
+	// Queue the input as if it was typed into the serial console
+	void hostInput(const char *str);
+	// Copy the output to stdout
+	bool echo;
+
+private:
+	char m_input[64];
+	byte m_input_len, m_input_pos;
+};
+
+extern HostSerial Serial;
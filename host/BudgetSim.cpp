@@ -0,0 +1,169 @@
+// Runs the gateway with a full set of motors and commands a blind at random
+// moments, then prints the command latency and the loop budget counters.
+// At the end one of the motors starts babbling on the bus without a pause,
+// so the gateway never sees the line go quiet, and the watchdog has to
+// reboot it. Then the timer of the soft serial stops in the middle of a
+// frame, so the send never ends, and the watchdog has to reboot it again.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+#include "../LoopBudget.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define SIM_MOTORS MAX_BLINDS
+#define BLINDS_TX_PIN 16
+#define PHASE_TIME (600 * VCLOCK_SEC)
+
+// The motors move instantly
+static SimMotor g_motors[SIM_MOTORS];
+static byte g_positions[SIM_MOTORS];
+static vtime_t g_commanded_at;
+static std::vector<double> g_latencies;
+static bool g_babbling;
+static word g_timer_period;
+
+// Until the board reboots, the reboot cuts the power to the line as well
+static void babble(void *ctx) {
+	if (!g_babbling || g_host_reboot_requested) {
+		return;
+	}
+	byte garbage = byte(simRandom());
+	simBusInject(&garbage, 1);
+	vclockSchedule(vclockNow() + SIM_BYTE_TIME, babble, 0);
+}
+
+// The timer stops with the next command and runs again after the reboot
+static void stallTimer(void *ctx) {
+	if (!g_host_reboot_requested) {
+		if (g_host_gpt_period) {
+			g_timer_period = g_host_gpt_period;
+			g_host_gpt_period = 0;
+		}
+		vclockSchedule(vclockNow() + VCLOCK_MS, stallTimer, 0);
+		return;
+	}
+	g_host_gpt_period = g_timer_period;
+}
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->len < 11) {
+		return;
+	}
+	SimMotor *m = simFindMotor(g_motors, SIM_MOTORS, &frame->data[6]);
+	if (!m) {
+		return;
+	}
+	byte *pos = &g_positions[m - g_motors];
+	if (frame->data[0] == MOVE_MOTOR_TO_POS) {
+		if (g_commanded_at) {
+			g_latencies.push_back(double(frame->startedAt - g_commanded_at) / VCLOCK_MS);
+			g_commanded_at = 0;
+		}
+		*pos = frame->data[9] == 0xFBu ? 0xFFu - frame->data[10] : 0;
+		return;
+	}
+	if (frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	simMotorReply(m, *pos, 0x1200 | *pos, frame->endedAt + SIM_REPLY_DELAY);
+}
+
+static void commandBlind(void *ctx) {
+	byte blind = byte(simRandom() % SIM_MOTORS);
+	g_channels_data[blind + 1].bParam = byte(simRandom() % 100);
+	g_host_channel_updated[blind + 2] = 1;
+	g_commanded_at = vclockNow();
+}
+
+int main() {
+	simRandomSeed(11);
+	simMotorsInit(g_motors, SIM_MOTORS);
+	simSeedEeprom(g_motors, SIM_MOTORS);
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		g_positions[i] = 40;
+	}
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	real_setup();
+	while(vclockNow() < 10 * VCLOCK_SEC) {
+		real_loop();
+	}
+	resetBudgetStats();
+
+	vtime_t at = vclockNow();
+	vtime_t end = at + PHASE_TIME;
+	while(true) {
+		at += VCLOCK_MS * (3000 + simRandom() % 4000);
+		if (at >= end) {
+			break;
+		}
+		vclockSchedule(at, commandBlind, 0);
+	}
+	while(vclockNow() < end) {
+		real_loop();
+	}
+	bool ok = !g_host_reboot_requested;
+
+	std::sort(g_latencies.begin(), g_latencies.end());
+	size_t n = g_latencies.size();
+	double sum = 0;
+	for(size_t i=0; i<n; ++i) {
+		sum += g_latencies[i];
+	}
+	printf("%u commands, latency ms: avg %.1f, p50 %.1f, max %.1f\n", unsigned(n), sum / n,
+		g_latencies[n / 2], g_latencies[n - 1]);
+	printf("%u loops, %u over %u ms, the longest %u ms\n", unsigned(g_budget_stats.loops),
+		unsigned(g_budget_stats.overruns), LOOP_BUDGET, g_budget_stats.maxLoopTime);
+	for(byte i=0; i<PHASE_COUNT; ++i) {
+		if (g_budget_stats.culprit[i]) {
+			printf("  %-14s %5u overruns, the longest %u ms\n", phaseName(i),
+				g_budget_stats.culprit[i], g_budget_stats.culpritMaxTime[i]);
+		}
+	}
+
+	// The babbling starts with the next command, the gateway waits for the
+	// line to go quiet after it
+	vtime_t started = vclockNow();
+	g_babbling = true;
+	vclockSchedule(started + VCLOCK_SEC, commandBlind, 0);
+	vclockSchedule(started + VCLOCK_SEC + 100 * VCLOCK_MS, babble, 0);
+	while(!g_host_reboot_requested && vclockNow() < started + 120 * VCLOCK_SEC) {
+		real_loop();
+	}
+	g_babbling = false;
+	byte phase = EEPROM.read(WATCHDOG_ADDR);
+	printf("babbling line: %s after %.1f s in %s\n",
+		g_host_reboot_requested ? "rebooted by the watchdog" : "FAILED: no reboot",
+		double(vclockNow() - started) / VCLOCK_SEC, phase < PHASE_COUNT ? phaseName(phase) : "?");
+	ok &= g_host_reboot_requested && phase == PHASE_COMMANDS;
+
+	// The reboot reports the phase and forgets it
+	g_host_reboot_requested = false;
+	real_setup();
+	ok &= EEPROM.read(WATCHDOG_ADDR) == 0xFF;
+
+	// A healthy iteration arms the watchdog again
+	started = vclockNow();
+	while(vclockNow() < started + 10 * VCLOCK_SEC) {
+		real_loop();
+	}
+	started = vclockNow();
+	vclockSchedule(started + VCLOCK_SEC, commandBlind, 0);
+	vclockSchedule(started + VCLOCK_SEC, stallTimer, 0);
+	while(!g_host_reboot_requested && vclockNow() < started + 120 * VCLOCK_SEC) {
+		real_loop();
+	}
+	phase = EEPROM.read(WATCHDOG_ADDR);
+	printf("stopped timer: %s after %.1f s in %s\n",
+		g_host_reboot_requested ? "rebooted by the watchdog" : "FAILED: no reboot",
+		double(vclockNow() - started) / VCLOCK_SEC, phase < PHASE_COUNT ? phaseName(phase) : "?");
+	ok &= g_host_reboot_requested && phase == PHASE_COMMANDS;
+	g_host_reboot_requested = false;
+	real_setup();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+// Presses the button in the gesture patterns and checks what the gateway
+// does: the learn mode, the button scene and the reset. While the button is
+// held for the reset, a Z-Wave command and a stop request arrive, and the
+// time until they are on the bus is measured.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+
+#define SIM_BLINDS 3
+#define BLINDS_TX_PIN 16
+#define BTN_PIN 18
+#define SCENE_STORE_PARAM 65
+#define CLICK_TIME (150 * VCLOCK_MS)
+#define CLICK_GAP (200 * VCLOCK_MS)
+
+void real_setup();
+void real_loop();
+void zunoSWMLCallback(byte dir, byte channel);
+
+// The frames on the bus since the marks
+static dword g_requests, g_moves;
+static vtime_t g_move_mark, g_move_at, g_stop_mark, g_stop_at;
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->data[0] == MOVE_MOTOR_TO_POS) {
+		g_moves++;
+		if (g_move_mark && !g_move_at && frame->startedAt >= g_move_mark) {
+			g_move_at = frame->startedAt;
+		}
+		return;
+	}
+	if (frame->data[0] == STOP_MOTOR) {
+		if (g_stop_mark && !g_stop_at && frame->startedAt >= g_stop_mark) {
+			g_stop_at = frame->startedAt;
+		}
+		return;
+	}
+	if (frame->len < 9 || frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	g_requests++;
+	// All the blinds are at 40%
+	byte reply[SIM_POSITION_LEN];
+	simPositionFrame(reply, &frame->data[6], 40, 0x1234);
+	simBusInject(reply, sizeof(reply));
+}
+
+static void setButton(void *ctx) {
+	g_host_pin_level[BTN_PIN] = ctx ? LOW : HIGH;
+}
+
+static void press(vtime_t at, vtime_t duration) {
+	vclockSchedule(at, setButton, (void*) 1);
+	vclockSchedule(at + duration, setButton, 0);
+}
+
+// Returns the time after the last click
+static vtime_t clicks(vtime_t at, byte count) {
+	for(byte i=0; i<count; ++i) {
+		press(at, CLICK_TIME);
+		at += CLICK_TIME + CLICK_GAP;
+	}
+	return at;
+}
+
+static void commandAllBlinds(void *ctx) {
+	g_move_mark = vclockNow();
+	g_channels_data[0].bParam = 29; // 70%
+	g_host_channel_updated[1] = 1;
+}
+
+static void requestStop(void *ctx) {
+	g_stop_mark = vclockNow();
+	zunoSWMLCallback(0, 1);
+}
+
+static void runUntil(vtime_t at) {
+	while(vclockNow() < at && !g_host_reboot_requested) {
+		real_loop();
+	}
+}
+
+int main() {
+	SimMotor motors[SIM_BLINDS];
+	simMotorsInit(motors, SIM_BLINDS);
+	simSeedEeprom(motors, SIM_BLINDS);
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	real_setup();
+	runUntil(5 * VCLOCK_SEC);
+	g_host_cfg_params[SCENE_STORE_PARAM] = 1;
+	runUntil(vclockNow() + VCLOCK_SEC);
+
+	bool ok = true;
+	dword learns = g_host_learn_started;
+	press(vclockNow(), 4 * VCLOCK_SEC);
+	runUntil(vclockNow() + 5 * VCLOCK_SEC);
+	printf("%-14s %s\n", "hold 4 s", g_host_learn_started == learns + 1 ?
+		"learn mode started" : "FAILED: no learn mode");
+	ok &= g_host_learn_started == learns + 1;
+
+	learns = g_host_learn_started;
+	runUntil(clicks(vclockNow(), 3) + 2 * VCLOCK_SEC);
+	printf("%-14s %s\n", "triple click", g_host_learn_started == learns + 1 ?
+		"learn mode started" : "FAILED: no learn mode");
+	ok &= g_host_learn_started == learns + 1;
+
+	g_moves = 0;
+	runUntil(clicks(vclockNow(), 2) + 2 * VCLOCK_SEC);
+	printf("%-14s scene 1 sent %u move frames\n", "double click", unsigned(g_moves));
+	ok &= g_moves == SIM_BLINDS && g_host_learn_started == learns + 1;
+
+	// The blinds are commanded and stopped while the button is held
+	vtime_t pressed = vclockNow();
+	dword requests = g_requests;
+	press(pressed, 10 * VCLOCK_SEC);
+	vclockSchedule(pressed + VCLOCK_SEC, commandAllBlinds, 0);
+	vclockSchedule(pressed + 3 * VCLOCK_SEC, requestStop, 0);
+	runUntil(pressed + 11 * VCLOCK_SEC);
+	bool reset = g_host_reboot_requested && EEPROM.read(MODE_ADDR) == 0;
+	printf("%-14s %u status requests, move on the bus after %.1f ms, stop after %.1f ms, %s\n",
+		"hold 10 s", unsigned(g_requests - requests),
+		g_move_at ? double(g_move_at - g_move_mark) / VCLOCK_MS : -1.0,
+		g_stop_at ? double(g_stop_at - g_stop_mark) / VCLOCK_MS : -1.0,
+		reset ? "reset" : "FAILED: no reset");
+	ok &= reset && g_move_at && g_stop_at;
+	return ok ? 0 : 1;
+}
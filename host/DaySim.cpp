@@ -0,0 +1,99 @@
+// Fast-forward simulation of a day of the gateway operation on the virtual
+// clock. The day is placed across the millis() wraparound. No motors reply,
+// so the blinds go offline and the gateway settles into the idle schedule.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+#include "../BusHealth.h"
+#include "../LoopStats.h"
+
+#include <stdio.h>
+#include <chrono>
+
+#define SIM_BLINDS 3
+
+struct Window {
+	const char *name;
+	vtime_t from, to;
+	dword requests, reports;
+	dword minPolls, maxPolls, minReports, maxReports;
+};
+
+static dword totalRequests() {
+	dword res = 0;
+	for(byte i=0; i<SIM_BLINDS; ++i) {
+		res += g_bus_health[i].requests - g_bus_health[i].retries;
+	}
+	return res;
+}
+
+static void markWindow(void *ctx) {
+	Window *w = (Window*) ctx;
+	dword requests = totalRequests();
+	dword reports = g_host_reports_sent[1];
+	if (vclockNow() == w->from) {
+		w->requests = requests;
+		w->reports = reports;
+	} else {
+		w->requests = requests - w->requests;
+		w->reports = reports - w->reports;
+	}
+}
+
+static void commandAllBlinds(void *ctx) {
+	g_channels_data[0].bParam = 50;
+	g_host_channel_updated[1] = 1;
+}
+
+int main() {
+	// A gateway that has been set up with three blinds
+	SimMotor motors[SIM_BLINDS];
+	simMotorsInit(motors, SIM_BLINDS);
+	simSeedEeprom(motors, SIM_BLINDS);
+
+	vtime_t start = VCLOCK_MILLIS_WRAP - 12 * VCLOCK_HOUR;
+	vclockReset(start);
+
+	// Idle periods poll every 600 s, routine reports go out with the polls
+	Window windows[] = {
+		{"idle", start + 3 * VCLOCK_HOUR, start + 11 * VCLOCK_HOUR, 0, 0, 47, 49, 47, 49},
+		{"wrap", start + 11 * VCLOCK_HOUR, start + 13 * VCLOCK_HOUR, 0, 0, 11, 13, 11, 13},
+		{"idle after wrap", start + 13 * VCLOCK_HOUR, start + 21 * VCLOCK_HOUR, 0, 0, 47, 49, 47, 49},
+	};
+	for(byte i=0; i<sizeof(windows)/sizeof(windows[0]); ++i) {
+		vclockSchedule(windows[i].from, markWindow, &windows[i]);
+		vclockSchedule(windows[i].to, markWindow, &windows[i]);
+	}
+	vclockSchedule(start + 2 * VCLOCK_HOUR, commandAllBlinds, 0);
+
+	auto wallStart = std::chrono::steady_clock::now();
+	real_setup();
+	dword iterations = 0;
+	while(vclockNow() < start + VCLOCK_DAY) {
+		real_loop();
+		iterations++;
+	}
+	auto wallTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - wallStart).count();
+
+	printf("Simulated 24h in %lld ms of real time, %u loop iterations\n",
+		(long long) wallTime, iterations);
+	bool ok = true;
+	for(byte i=0; i<sizeof(windows)/sizeof(windows[0]); ++i) {
+		Window *w = &windows[i];
+		dword polls = w->requests / SIM_BLINDS;
+		bool windowOk = polls >= w->minPolls && polls <= w->maxPolls &&
+			w->reports >= w->minReports && w->reports <= w->maxReports;
+		printf("%-16s polls %3u (expected %u-%u), reports %3u (expected %u-%u)%s\n",
+			w->name, polls, w->minPolls, w->maxPolls, w->reports,
+			w->minReports, w->maxReports, windowOk ? "" : "  <-- FAILED");
+		ok &= windowOk;
+	}
+#ifdef PROFILE_LOOP
+	Serial.echo = true;
+	dumpLoopStats();
+#endif
+	return ok ? 0 : 1;
+}
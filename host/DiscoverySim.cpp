@@ -0,0 +1,156 @@
+// Adds two motors to a running gateway with the online discovery. All the
+// motors answer the discovery broadcasts at random moments, so the replies
+// collide on the bus as they do on the real one. Direct commands to a known
+// blind arrive at random times before, during and after the discovery, and
+// the time until the move frame is on the bus is compared. After the
+// discovery there are more blinds to poll, so that is the fair baseline for
+// the time during it. At the end of the discovery the gateway reboots to
+// set up the new channels.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define KNOWN_MOTORS 3
+#define SIM_MOTORS 5
+#define BLINDS_TX_PIN 16
+#define DISCOVERY_PARAM 66
+// The motors answer the discovery within this time
+#define SIM_DISCOVERY_SPREAD (60 * VCLOCK_MS)
+#define PHASE_TIME (280 * VCLOCK_SEC)
+
+void real_setup();
+void real_loop();
+
+extern byte numBlinds;
+
+// The motors move instantly
+static SimMotor g_motors[SIM_MOTORS];
+static byte g_positions[SIM_MOTORS];
+static dword g_broadcasts, g_reboots;
+static vtime_t g_commanded_at, g_found_at;
+static std::vector<double> g_latencies;
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->data[0] == DISCOVER_ALL_MOTORS) {
+		g_broadcasts++;
+		for(byte i=0; i<SIM_MOTORS; ++i) {
+			simMotorAnnounce(&g_motors[i], frame->endedAt + SIM_REPLY_DELAY +
+				simRandom() % SIM_DISCOVERY_SPREAD);
+		}
+		return;
+	}
+	if (frame->len < 11) {
+		return;
+	}
+	SimMotor *m = simFindMotor(g_motors, SIM_MOTORS, &frame->data[6]);
+	if (!m) {
+		return;
+	}
+	byte *pos = &g_positions[m - g_motors];
+	if (frame->data[0] == MOVE_MOTOR_TO_POS) {
+		if (g_commanded_at) {
+			g_latencies.push_back(double(frame->startedAt - g_commanded_at) / VCLOCK_MS);
+			g_commanded_at = 0;
+		}
+		*pos = frame->data[9] == 0xFBu ? 0xFFu - frame->data[10] : 0;
+		return;
+	}
+	if (frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	simMotorReply(m, *pos, 0x1200 | *pos, frame->endedAt + SIM_REPLY_DELAY);
+}
+
+static void commandBlind(void *ctx) {
+	static byte target = 30;
+	target = target == 30 ? 60 : 30;
+	g_channels_data[1].bParam = 99 - target;
+	g_host_channel_updated[2] = 1;
+	g_commanded_at = vclockNow();
+}
+
+// Command the first blind at random moments, returns the latencies
+static std::vector<double> measure(vtime_t from, vtime_t to) {
+	g_latencies.clear();
+	vtime_t at = from;
+	while(true) {
+		at += VCLOCK_MS * (3000 + simRandom() % 4000);
+		if (at >= to) {
+			break;
+		}
+		vclockSchedule(at, commandBlind, 0);
+	}
+	while(vclockNow() < to) {
+		real_loop();
+		if (!g_found_at && numBlinds == SIM_MOTORS) {
+			g_found_at = vclockNow();
+		}
+		if (g_host_reboot_requested) {
+			// The gateway reboots to set up the channels of the new blinds
+			g_host_reboot_requested = false;
+			g_reboots++;
+			real_setup();
+		}
+	}
+	std::sort(g_latencies.begin(), g_latencies.end());
+	return g_latencies;
+}
+
+static void printLatencies(const char *name, const std::vector<double> &l) {
+	size_t n = l.size();
+	double sum = 0;
+	for(size_t i=0; i<n; ++i) {
+		sum += l[i];
+	}
+	printf("%-20s %3u commands, ms: avg %.1f, p50 %.1f, max %.1f\n", name, unsigned(n),
+		sum / n, l[n / 2], l[n - 1]);
+}
+
+int main() {
+	simRandomSeed(7);
+	simMotorsInit(g_motors, SIM_MOTORS);
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		g_motors[i].addr[0] = 0x10 + i * 7;
+		g_motors[i].addr[1] = 0x20 + i;
+		g_positions[i] = 40;
+	}
+	// Only the first motors are known
+	simSeedEeprom(g_motors, KNOWN_MOTORS);
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	real_setup();
+	while(vclockNow() < 5 * VCLOCK_SEC) {
+		real_loop();
+	}
+	byte channels = g_host_num_channels;
+
+	std::vector<double> before = measure(vclockNow(), vclockNow() + PHASE_TIME);
+	g_host_cfg_params[DISCOVERY_PARAM] = 1;
+	vtime_t started = vclockNow();
+	std::vector<double> during = measure(started, started + PHASE_TIME);
+	// Let the discovery window close
+	while(vclockNow() < started + 310 * VCLOCK_SEC) {
+		real_loop();
+	}
+	std::vector<double> after = measure(vclockNow(), vclockNow() + PHASE_TIME);
+
+	printLatencies("before discovery", before);
+	printLatencies("during discovery", during);
+	printLatencies("after discovery", after);
+	bool ok = numBlinds == SIM_MOTORS;
+	for(byte i=0; i<SIM_MOTORS && ok; ++i) {
+		// The known blinds keep their numbers, the new ones follow
+		ok = EEPROM.read(BLINDS_ADDR + i*3) == g_motors[i].addr[0] &&
+			EEPROM.read(BLINDS_ADDR + i*3 + 1) == g_motors[i].addr[1];
+	}
+	printf("%u broadcasts, all motors found after %.1f s, %u blinds, channels %u -> %u after %u reboot, table %s\n",
+		unsigned(g_broadcasts), g_found_at ? double(g_found_at - started) / VCLOCK_SEC : -1.0,
+		numBlinds, channels, g_host_num_channels, unsigned(g_reboots), ok ? "ok" : "WRONG");
+	return ok && g_reboots == 1 && g_host_num_channels == channels + SIM_MOTORS - KNOWN_MOTORS ? 0 : 1;
+}
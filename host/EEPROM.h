@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE 2048
+
+class EEPROMClass {
+public:
+	EEPROMClass();
+	byte read(word addr);
+	void write(word addr, byte value);
+
+	// Number of writes, to check the wear
+	dword writes;
+	byte data[HOST_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
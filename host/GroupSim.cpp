@@ -0,0 +1,209 @@
+// Runs a series of group moves against simulated motors that travel at
+// different speeds, and compares the arrival spread that the gateway has
+// planned and measured with the real one of the motors. The first move is
+// made before any travel rate is known, the gateway times it and plans the
+// following ones. At the end the positions are stored as a scene, and the
+// scene is run from another position.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+
+#define SIM_MOTORS 4
+#define BLINDS_TX_PIN 16
+// The motor starts moving this long after the command
+#define SIM_START_DELAY (200 * VCLOCK_MS)
+#define SCENE_RUN_PARAM 64
+#define SCENE_STORE_PARAM 65
+
+void real_setup();
+void real_loop();
+
+extern byte groupRemaining;
+extern word groupUnplannedSpread, groupPlannedSpread, groupActualSpread;
+
+// A motor that moves at a constant speed, its ticks go up or down with the
+// position depending on how it's mounted. It's the same motor as the one in
+// g_sim with the same index.
+struct Motor {
+	double speed; // % per second
+	int ticksPerPct;
+	double pos, target;
+	vtime_t startAt, updatedAt, arrivedAt;
+	bool moving;
+};
+
+static Motor g_motors[SIM_MOTORS] = {
+	{2.0, 120},
+	{3.0, -95},
+	{4.5, 150},
+	{6.5, 80},
+};
+static SimMotor g_sim[SIM_MOTORS];
+
+// The burst of the move frames that ends with the next status request
+static bool g_burst_open;
+static dword g_burst_frames;
+static vtime_t g_burst_started, g_burst_ended;
+
+static void advance(Motor *m, vtime_t now) {
+	if (!m->moving || now <= m->startAt) {
+		return;
+	}
+	vtime_t from = m->updatedAt > m->startAt ? m->updatedAt : m->startAt;
+	double step = m->speed * double(now - from) / VCLOCK_SEC;
+	double left = m->target > m->pos ? m->target - m->pos : m->pos - m->target;
+	if (step >= left) {
+		m->arrivedAt = from + vtime_t(left / m->speed * VCLOCK_SEC);
+		m->pos = m->target;
+		m->moving = false;
+	} else {
+		m->pos += m->target > m->pos ? step : -step;
+	}
+	m->updatedAt = now;
+}
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->len < 9) {
+		return;
+	}
+	SimMotor *sim = simFindMotor(g_sim, SIM_MOTORS, &frame->data[6]);
+	if (!sim) {
+		return;
+	}
+	Motor *m = &g_motors[sim - g_sim];
+	advance(m, frame->endedAt);
+
+	if (frame->data[0] == MOVE_MOTOR_TO_POS && frame->len >= 11) {
+		if (g_burst_open) {
+			if (!g_burst_frames++) {
+				g_burst_started = frame->startedAt;
+			}
+			g_burst_ended = frame->endedAt;
+		}
+		if (frame->data[9] == 0xFBu) {
+			m->target = 0xFFu - frame->data[10];
+		} else {
+			m->target = frame->data[9] == 0xFEu ? 0 : 100;
+		}
+		if (!m->moving && m->target != m->pos) {
+			m->moving = true;
+			m->startAt = frame->endedAt + SIM_START_DELAY;
+			m->updatedAt = m->startAt;
+		}
+		return;
+	}
+	if (frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	if (g_burst_frames) {
+		g_burst_open = false;
+	}
+	// The percentage is rounded down, the ticks are not
+	simMotorReply(sim, byte(m->pos), word(30000 + m->pos * m->ticksPerPct),
+		frame->endedAt + SIM_REPLY_DELAY);
+}
+
+static bool motorsMoving() {
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		advance(&g_motors[i], vclockNow());
+		if (g_motors[i].moving) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Move all the blinds through the group channel and wait until they settle
+static bool groupMove(byte from, byte to) {
+	g_channels_data[0].bParam = 99 - to;
+	g_host_channel_updated[1] = 1;
+	vtime_t commanded = vclockNow();
+	vtime_t deadline = commanded + 90 * VCLOCK_SEC;
+	real_loop();
+	while((motorsMoving() || groupRemaining) && vclockNow() < deadline) {
+		real_loop();
+	}
+	vtime_t first = 0, last = 0;
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		vtime_t at = g_motors[i].arrivedAt;
+		if (g_motors[i].pos != to || at < commanded) {
+			printf("%3d -> %2d: motor %d didn't arrive\n", from, to, i);
+			return false;
+		}
+		if (!first || at < first) {
+			first = at;
+		}
+		if (at > last) {
+			last = at;
+		}
+	}
+	printf("%3d -> %2d %12u %12u %12u %12.0f %9.1f\n", from, to, groupUnplannedSpread,
+		groupPlannedSpread, groupActualSpread, double(last - first) / VCLOCK_MS,
+		double(last - commanded) / VCLOCK_SEC);
+	// Let the polling settle down
+	while(vclockNow() < last + 5 * VCLOCK_SEC) {
+		real_loop();
+	}
+	return true;
+}
+
+// Store the current positions as the scene 1, move away and run the scene
+static bool sceneMove(byte at, byte away) {
+	g_host_cfg_params[SCENE_STORE_PARAM] = 1;
+	real_loop();
+	if (!groupMove(at, away)) {
+		return false;
+	}
+	g_burst_frames = 0;
+	g_burst_open = true;
+	g_host_cfg_params[SCENE_RUN_PARAM] = 1;
+	vtime_t deadline = vclockNow() + 90 * VCLOCK_SEC;
+	real_loop();
+	if (g_host_cfg_params[SCENE_RUN_PARAM]) {
+		printf("scene 1 wasn't run\n");
+		return false;
+	}
+	while(motorsMoving() && vclockNow() < deadline) {
+		real_loop();
+	}
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		if (g_motors[i].pos != at) {
+			printf("scene 1: motor %d is at %.1f instead of %d\n", i, g_motors[i].pos, at);
+			return false;
+		}
+	}
+	printf("scene 1: a burst of %u move frames in %.1f ms\n", unsigned(g_burst_frames),
+		double(g_burst_ended - g_burst_started) / VCLOCK_MS);
+	return true;
+}
+
+int main() {
+	simMotorsInit(g_sim, SIM_MOTORS);
+	simSeedEeprom(g_sim, SIM_MOTORS);
+	for(byte i=0; i<SIM_MOTORS; ++i) {
+		g_motors[i].pos = g_motors[i].target = 10;
+	}
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	real_setup();
+	while(vclockNow() < 5 * VCLOCK_SEC) {
+		real_loop();
+	}
+
+	byte moves[] = {10, 90, 10, 60, 20, 90, 10};
+	printf("%-8s %12s %12s %12s %12s %9s\n", "move", "unplanned ms", "planned ms",
+		"measured ms", "motors ms", "total s");
+	for(byte i=1; i<sizeof(moves); ++i) {
+		if (!groupMove(moves[i - 1], moves[i])) {
+			return 1;
+		}
+	}
+	bool ok = sceneMove(moves[sizeof(moves) - 1], 60);
+	// The positions, the travel rates and the scene
+	printf("%u EEPROM writes\n", unsigned(EEPROM.writes));
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,332 @@
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "Wire.h"
+#include "VirtualClock.h"
+
+#include <stdio.h>
+#include <chrono>
+
+bool softSerialBusy();
+
+static void (*g_host_gpt_handler)();
+
+// Move the time forward, running the timer interrupt on the way if needed
+static void hostAdvance(vtime_t us) {
+	vtime_t target = vclockNow() + us;
+	if (g_host_gpt_enabled && g_host_gpt_handler && g_host_gpt_period) {
+		// The ticks are on a fixed grid, the handler's own time doesn't move them
+		vtime_t period = (g_host_gpt_period + 2) / 4;
+		while(g_host_gpt_enabled && (g_host_gpt_all_ticks || softSerialBusy())) {
+			vtime_t now = vclockNow();
+			vtime_t next = (now / period + 1) * period;
+			if (next > target) {
+				break;
+			}
+			vclockAdvance(next - now);
+			if (!g_host_gpt_all_ticks) {
+				g_host_gpt_handler();
+				continue;
+			}
+			dword pinOps = g_host_pin_reads + g_host_pin_writes;
+			std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			g_host_gpt_handler();
+			g_host_gpt_ns += std::chrono::duration<double, std::nano>(
+				std::chrono::steady_clock::now() - started).count();
+			g_host_gpt_calls++;
+			g_host_gpt_pin_ops += g_host_pin_reads + g_host_pin_writes - pinOps;
+		}
+	}
+	if (target > vclockNow()) {
+		vclockAdvance(target - vclockNow());
+	}
+}
+
+// Time
+
+dword millis() {
+	return dword(vclockNow() / VCLOCK_MS);
+}
+
+dword micros() {
+	return dword(vclockNow());
+}
+
+void delay(dword ms) {
+	hostAdvance(vtime_t(ms) * VCLOCK_MS);
+}
+
+void delayMicroseconds(word us) {
+	hostAdvance(us);
+}
+
+// Pins
+
+byte g_host_pin_level[HOST_NUM_PINS];
+byte g_host_pin_mode[HOST_NUM_PINS];
+void (*g_host_pin_observer)(byte pin, byte value);
+word g_host_digital_write_us;
+dword g_host_pin_reads, g_host_pin_writes;
+
+void pinMode(byte pin, byte mode) {
+	g_host_pin_mode[pin] = mode;
+	if (mode == INPUT_PULLUP) {
+		g_host_pin_level[pin] = HIGH;
+	}
+}
+
+void digitalWrite(byte pin, byte value) {
+	if (g_host_digital_write_us) {
+		vclockAdvance(g_host_digital_write_us);
+	}
+	g_host_pin_writes++;
+	g_host_pin_level[pin] = value ? HIGH : LOW;
+	if (g_host_pin_observer) {
+		g_host_pin_observer(pin, g_host_pin_level[pin]);
+	}
+}
+
+byte digitalRead(byte pin) {
+	g_host_pin_reads++;
+	return g_host_pin_level[pin];
+}
+
+// CPU
+
+void noInterrupts_F() {
+}
+
+void interrupts_F() {
+}
+
+void sysClockSet(byte mode) {
+}
+
+void sysClockNormallize() {
+}
+
+byte g_host_gpt_enabled;
+word g_host_gpt_period;
+byte g_host_gpt_all_ticks;
+dword g_host_gpt_calls, g_host_gpt_pin_ops;
+double g_host_gpt_ns;
+
+byte hostSetGptHandler(void (*handler)()) {
+	g_host_gpt_handler = handler;
+	return 1;
+}
+
+void zunoGPTInit(byte flags) {
+}
+
+void zunoGPTSet(word period) {
+	g_host_gpt_period = period;
+}
+
+void zunoGPTEnable(byte enable) {
+	g_host_gpt_enabled = enable;
+}
+
+// Z-Wave
+
+ZUNOChannelData g_channels_data[ZUNO_MAX_CHANNELS];
+byte g_host_channel_updated[ZUNO_MAX_CHANNELS + 1];
+dword g_host_reports_sent[ZUNO_MAX_CHANNELS + 1];
+byte g_host_num_channels;
+bool g_host_in_network = true;
+bool g_host_reboot_requested;
+dword g_host_learn_started;
+word g_host_cfg_params[256];
+
+bool zunoIsChannelUpdated(byte channel) {
+	bool updated = g_host_channel_updated[channel] != 0;
+	g_host_channel_updated[channel] = 0;
+	return updated;
+}
+
+void zunoSendUncolicitedReport(byte channel) {
+	g_host_reports_sent[channel]++;
+}
+
+bool zunoInNetwork() {
+	return g_host_in_network;
+}
+
+void zunoStartLearn(byte timeout, byte secure) {
+	g_host_learn_started++;
+}
+
+void zunoReboot() {
+	// The simulation decides what to do with it
+	g_host_reboot_requested = true;
+}
+
+void zunoSaveCFGParam(byte param, word value) {
+	g_host_cfg_params[param] = value;
+}
+
+word zunoLoadCFGParam(byte param) {
+	return g_host_cfg_params[param];
+}
+
+void hostStartConfig() {
+	g_host_num_channels = 0;
+}
+
+void hostAddChannel(byte type) {
+	g_host_num_channels++;
+}
+
+// Text output
+
+void Print::print(const char *str) {
+	while(*str) {
+		write(*str++);
+	}
+}
+
+void Print::print(char c) {
+	write(c);
+}
+
+void Print::printNumber(unsigned long num, int base) {
+	char buf[8 * sizeof(num) + 1];
+	char *pos = &buf[sizeof(buf) - 1];
+	*pos = 0;
+	do {
+		byte digit = num % base;
+		*--pos = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		num /= base;
+	} while(num);
+	print(pos);
+}
+
+void Print::print(unsigned char num, int base) {
+	printNumber(num, base);
+}
+
+void Print::print(int num, int base) {
+	print(long(num), base);
+}
+
+void Print::print(unsigned int num, int base) {
+	printNumber(num, base);
+}
+
+void Print::print(long num, int base) {
+	if (num < 0 && base == DEC) {
+		write('-');
+		printNumber(-num, base);
+		return;
+	}
+	printNumber(num, base);
+}
+
+void Print::print(unsigned long num, int base) {
+	printNumber(num, base);
+}
+
+void Print::println() {
+	write('\r');
+	write('\n');
+}
+
+void Print::println(const char *str) {
+	print(str);
+	println();
+}
+
+void Print::println(char c) {
+	print(c);
+	println();
+}
+
+void Print::println(unsigned char num, int base) {
+	print(num, base);
+	println();
+}
+
+void Print::println(int num, int base) {
+	print(num, base);
+	println();
+}
+
+void Print::println(unsigned int num, int base) {
+	print(num, base);
+	println();
+}
+
+void Print::println(long num, int base) {
+	print(num, base);
+	println();
+}
+
+void Print::println(unsigned long num, int base) {
+	print(num, base);
+	println();
+}
+
+HostSerial Serial;
+
+void HostSerial::begin(dword baud) {
+}
+
+uint8_t HostSerial::available() {
+	return m_input_len - m_input_pos;
+}
+
+uint8_t HostSerial::read() {
+	if (m_input_pos == m_input_len) {
+		return 0xFF;
+	}
+	return m_input[m_input_pos++];
+}
+
+void HostSerial::write(uint8_t value) {
+	if (echo) {
+		putchar(value);
+	}
+}
+
+void HostSerial::hostInput(const char *str) {
+	m_input_len = m_input_pos = 0;
+	while(*str && m_input_len < sizeof(m_input)) {
+		m_input[m_input_len++] = *str++;
+	}
+}
+
+// Peripherals
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() {
+	// Erased flash
+	memset(data, 0xFF, sizeof(data));
+	writes = 0;
+}
+
+byte EEPROMClass::read(word addr) {
+	return data[addr % HOST_EEPROM_SIZE];
+}
+
+void EEPROMClass::write(word addr, byte value) {
+	data[addr % HOST_EEPROM_SIZE] = value;
+	writes++;
+}
+
+TwoWire Wire;
+
+void TwoWire::begin() {
+}
+
+void TwoWire::beginTransmission(byte addr) {
+	transmissions++;
+}
+
+void TwoWire::write(byte value) {
+	bytesWritten++;
+}
+
+byte TwoWire::endTransmission() {
+	// 2 is "address NACK" in the Arduino API
+	return nack ? 2 : 0;
+}
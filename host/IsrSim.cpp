@@ -0,0 +1,126 @@
+// Measures the load of the soft serial timer interrupt: the handler calls,
+// the pin accesses and the host time spent in the handler per second, while
+// the gateway polls the blinds and while it's idle. The motors reply on the
+// RX pin bit by bit, so the receiver does its real work. Each phase runs
+// with the passive listening on and then with the timer stopped between the
+// exchanges.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+#include "../OddSoftSer.h"
+
+#include <stdio.h>
+
+#define SIM_BLINDS 3
+#define BLINDS_TX_PIN 16
+#define BLINDS_RX_PIN 15
+#define SIM_BIT_TIME (VCLOCK_SEC / 4800)
+
+void real_setup();
+void real_loop();
+
+extern OddSoftSer blindsSerial;
+
+// The reply that is being put on the RX pin, a bit at a time
+struct Reply {
+	byte data[SIM_POSITION_LEN];
+	byte len, pos, bit;
+};
+
+static Reply g_reply;
+
+static byte oddParityBit(byte b) {
+	byte parity = 1;
+	for(byte i=0; i<8; ++i) {
+		parity ^= (b >> i) & 1;
+	}
+	return parity;
+}
+
+static void sendReplyBit(void *ctx) {
+	Reply *r = (Reply*) ctx;
+	byte b = r->data[r->pos];
+	byte level;
+	if (r->bit == 0) {
+		level = LOW;
+	} else if (r->bit <= 8) {
+		level = (b >> (r->bit - 1)) & 1;
+	} else if (r->bit == 9) {
+		level = oddParityBit(b);
+	} else {
+		level = HIGH;
+	}
+	g_host_pin_level[BLINDS_RX_PIN] = level;
+	if (++r->bit == 11) {
+		r->bit = 0;
+		if (++r->pos == r->len) {
+			return;
+		}
+	}
+	vclockSchedule(vclockNow() + SIM_BIT_TIME, sendReplyBit, r);
+}
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->len < 9 || frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	simPositionFrame(g_reply.data, &frame->data[6], 40, 0x1234);
+	g_reply.len = SIM_POSITION_LEN;
+	g_reply.pos = 0;
+	g_reply.bit = 0;
+	vclockSchedule(frame->endedAt + SIM_REPLY_DELAY, sendReplyBit, &g_reply);
+}
+
+static void commandAllBlinds(void *ctx) {
+	g_channels_data[0].bParam = 50;
+	g_host_channel_updated[1] = 1;
+}
+
+static void runUntil(vtime_t at) {
+	while(vclockNow() < at) {
+		real_loop();
+	}
+}
+
+// Run the gateway for the given time and print the interrupt load
+static void measure(const char *name, vtime_t duration) {
+	dword calls = g_host_gpt_calls;
+	double ns = g_host_gpt_ns;
+	dword pins = g_host_gpt_pin_ops;
+	vtime_t started = vclockNow();
+	runUntil(started + duration);
+	// The last loop iteration usually runs past the end
+	double seconds = double(vclockNow() - started) / VCLOCK_SEC;
+	printf("%-20s %10.0f %10.0f %12.0f\n", name, (g_host_gpt_calls - calls) / seconds,
+		(g_host_gpt_pin_ops - pins) / seconds,
+		(g_host_gpt_ns - ns) / seconds);
+}
+
+int main() {
+	SimMotor motors[SIM_BLINDS];
+	simMotorsInit(motors, SIM_BLINDS);
+	simSeedEeprom(motors, SIM_BLINDS);
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	g_host_gpt_all_ticks = 1;
+	real_setup();
+
+	printf("%-20s %10s %10s %12s\n", "", "irq/s", "pin ops/s", "host ns/s");
+	// The blinds are commanded, they are polled every second. Later the
+	// screen is off and nothing happens until the next poll in 10 minutes.
+	vclockSchedule(vclockNow() + VCLOCK_SEC, commandAllBlinds, 0);
+	runUntil(5 * VCLOCK_SEC);
+	measure("polling, listening", 30 * VCLOCK_SEC);
+	runUntil(120 * VCLOCK_SEC);
+	measure("idle, listening", 60 * VCLOCK_SEC);
+
+	blindsSerial.listen(false);
+	vclockSchedule(vclockNow() + VCLOCK_SEC, commandAllBlinds, 0);
+	runUntil(vclockNow() + 5 * VCLOCK_SEC);
+	measure("polling, gated", 30 * VCLOCK_SEC);
+	runUntil(vclockNow() + 120 * VCLOCK_SEC);
+	measure("idle, gated", 60 * VCLOCK_SEC);
+	return 0;
+}
@@ -0,0 +1,227 @@
+// Microbenchmarks of the hot paths of the gateway, measured on the host.
+//
+// The numbers are host nanoseconds, not Z-Uno cycles, but they move together
+// with the amount of work done per operation, so a regression shows up here
+// before the code is flashed. Each benchmark is warmed up and then sampled
+// several times; the median is the number to compare between builds, the
+// minimum shows how noisy the machine was.
+//
+// Usage: microbench [name-filter]
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../OddSoftSer.h"
+#include "../FixedOled.h"
+#include "../FrameParser.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#define BENCH_BLINDS 4
+#define BENCH_SAMPLES 9
+#define BENCH_SAMPLE_NS 20000000.0 // Each sample runs for at least 20 ms
+#define RX_PIN 15
+
+void real_setup();
+void softserial_gpt_handler();
+void sendSomfyMessage(byte bus, byte msgId, byte *payload, byte payloadLen);
+void pumpBus();
+void updateBlindPosition(byte i, byte newPos, word ticks);
+void clearScreen();
+void printStatus();
+
+extern OLED oled;
+extern dword lastInterestingTime;
+
+// Runs the operation the given number of times
+typedef void (*bench_fn_t)(dword iterations);
+
+struct Benchmark {
+	const char *name;
+	const char *unit;
+	bench_fn_t fn;
+};
+
+// Keeps the compiler from throwing the results away
+static volatile dword g_sink;
+// The blinds of the gateway, the replies come from the first one
+static SimMotor g_motors[BENCH_BLINDS];
+
+////////////////////////////////////////////////////////////////////////////
+// Frame encoding: building the frame, the checksum, the send queue and the
+// interrupt handler ticks that put it on the line. The pin writes are
+// stand-ins on the host.
+static void benchFrameEncode(dword iterations) {
+	byte payload[] = {0x80u, 0x80u, 0x80u, 0x10, 0x11, 0x12};
+	while(iterations--) {
+		payload[5] = byte(iterations);
+		sendSomfyMessage(0, REPORT_MOTOR_STATUS, payload, sizeof(payload));
+	}
+}
+
+// The checksum and the framing of a reply alone, byte by byte
+static void benchFrameParse(dword iterations) {
+	byte frame[SIM_POSITION_LEN];
+	simPositionFrame(frame, g_motors[0].addr, 63, 0x1234);
+
+	FrameParser parser;
+	frameParserReset(&parser);
+	dword frames = 0;
+	while(iterations--) {
+		for(byte i=0; i<sizeof(frame); ++i) {
+			frames += frameParserFeed(&parser, frame[i]);
+		}
+	}
+	g_sink = frames;
+}
+
+// pumpBus() on a reply that is already in the receive buffer, including
+// the dispatching of the frame to the blind it came from
+static void benchPumpBus(dword iterations) {
+	byte frame[SIM_POSITION_LEN];
+	while(iterations--) {
+		simPositionFrame(frame, g_motors[0].addr, byte(iterations % 101), 0x1234);
+		simBusInject(frame, sizeof(frame));
+		pumpBus();
+	}
+}
+
+// The GPT interrupt handler, for a whole byte: 11 bits sampled at 2x the
+// baud rate, plus a couple of idle ticks between the bytes.
+#define RX_TICKS_PER_BYTE 24
+
+static byte g_rx_wave[256][RX_TICKS_PER_BYTE];
+
+static void prepareRxWave() {
+	for(word b=0; b<256; ++b) {
+		byte parity = 1; // Odd parity
+		for(byte bit=0; bit<8; ++bit) {
+			parity ^= (b >> bit) & 1;
+		}
+		for(byte tick=0; tick<RX_TICKS_PER_BYTE; ++tick) {
+			byte bit = tick / 2;
+			byte level;
+			if (bit == 0) {
+				level = LOW; // Start bit
+			} else if (bit <= 8) {
+				level = (b >> (bit - 1)) & 1;
+			} else if (bit == 9) {
+				level = parity;
+			} else {
+				level = HIGH; // Stop bit and idle
+			}
+			g_rx_wave[b][tick] = level;
+		}
+	}
+}
+
+static void benchRxIsr(dword iterations) {
+	while(iterations--) {
+		byte *wave = g_rx_wave[iterations & 0xFF];
+		for(byte tick=0; tick<RX_TICKS_PER_BYTE; ++tick) {
+			g_host_pin_level[RX_PIN] = wave[tick];
+			softserial_gpt_handler();
+		}
+	}
+	g_ports[0].read_pos = g_ports[0].write_pos;
+}
+
+// The GPT interrupt handler on an idle line, which is most of its calls
+static void benchRxIdle(dword iterations) {
+	g_host_pin_level[RX_PIN] = HIGH;
+	while(iterations--) {
+		softserial_gpt_handler();
+	}
+}
+
+// One character of the OLED font
+static void benchOledWrite(dword iterations) {
+	byte col = 0;
+	while(iterations--) {
+		if (col == 0) {
+			oled.gotoXY(0, 2);
+		}
+		oled.write('0' + col);
+		if (++col == 20) {
+			col = 0;
+		}
+	}
+}
+
+// A refresh where one blind has moved, the common case while the blinds
+// are moving
+static void benchPrintStatus(dword iterations) {
+	while(iterations--) {
+		lastInterestingTime = millis();
+		updateBlindPosition(iterations % BENCH_BLINDS, iterations % 101, word(iterations));
+		printStatus();
+	}
+}
+
+// A refresh of the whole screen, after it has been cleared
+static void benchPrintStatusFull(dword iterations) {
+	while(iterations--) {
+		lastInterestingTime = millis();
+		clearScreen();
+		printStatus();
+	}
+}
+
+static Benchmark g_benchmarks[] = {
+	{"frame_encode", "frame", benchFrameEncode},
+	{"frame_parse", "frame", benchFrameParse},
+	{"pump_bus", "frame", benchPumpBus},
+	{"rx_isr", "byte", benchRxIsr},
+	{"rx_idle", "tick", benchRxIdle},
+	{"oled_write", "glyph", benchOledWrite},
+	{"print_status", "refresh", benchPrintStatus},
+	{"print_status_full", "refresh", benchPrintStatusFull},
+};
+
+static double runSample(bench_fn_t fn, dword iterations) {
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	fn(iterations);
+	std::chrono::steady_clock::time_point ended = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(ended - started).count();
+}
+
+static void runBenchmark(const Benchmark *bench) {
+	// Find the number of iterations that takes long enough to time reliably
+	dword iterations = 16;
+	double elapsed;
+	while((elapsed = runSample(bench->fn, iterations)) < BENCH_SAMPLE_NS / 4) {
+		iterations *= 2;
+	}
+	iterations = dword(iterations * BENCH_SAMPLE_NS / elapsed) + 1;
+
+	std::vector<double> samples;
+	for(int i=0; i<BENCH_SAMPLES; ++i) {
+		samples.push_back(runSample(bench->fn, iterations) / iterations);
+	}
+	std::sort(samples.begin(), samples.end());
+	printf("%-20s %12.1f %12.1f  ns/%s\n", bench->name,
+		samples[BENCH_SAMPLES / 2], samples[0], bench->unit);
+}
+
+int main(int argc, char **argv) {
+	const char *filter = argc > 1 ? argv[1] : "";
+
+	simMotorsInit(g_motors, BENCH_BLINDS);
+	simSeedEeprom(g_motors, BENCH_BLINDS);
+	vclockReset(0);
+	real_setup();
+	prepareRxWave();
+
+	printf("%-20s %12s %12s\n", "benchmark", "median", "min");
+	for(size_t i=0; i<sizeof(g_benchmarks) / sizeof(g_benchmarks[0]); ++i) {
+		if (strstr(g_benchmarks[i].name, filter)) {
+			runBenchmark(&g_benchmarks[i]);
+		}
+	}
+	return 0;
+}
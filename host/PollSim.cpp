@@ -0,0 +1,58 @@
+// Measures how long a pass of the status polling takes. The motors reply to
+// the status requests at the real byte rate, every tenth request is lost.
+// Built once for each supported number of buses (pollsim and pollsim2), the
+// blinds are spread across the buses evenly.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+
+#define SIM_BLINDS 8
+#define SIM_PASSES 50
+#define BLINDS_TX_PIN 16
+#define BUS2_TX_PIN 4
+#define SIM_LOST_EVERY 10
+
+bool readMotorStates();
+
+static SimMotor g_motors[SIM_BLINDS];
+static dword g_requests;
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	if (frame->len < 9 || frame->data[0] != REPORT_MOTOR_STATUS) {
+		return;
+	}
+	if (++g_requests % SIM_LOST_EVERY == 0) {
+		return;
+	}
+	SimMotor *m = simFindMotor(g_motors, SIM_BLINDS, &frame->data[6]);
+	if (m) {
+		simMotorReply(m, 40, 0x1234, frame->endedAt + SIM_REPLY_DELAY);
+	}
+}
+
+int main() {
+	simMotorsInit(g_motors, SIM_BLINDS);
+	for(byte i=0; i<SIM_BLINDS; ++i) {
+		g_motors[i].port = i % NUM_BUSES;
+	}
+	simSeedEeprom(g_motors, SIM_BLINDS);
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+#if NUM_BUSES > 1
+	simBusAttachPort(1, BUS2_TX_PIN);
+#endif
+	real_setup();
+
+	vtime_t started = vclockNow();
+	for(int i=0; i<SIM_PASSES; ++i) {
+		readMotorStates();
+	}
+	double passMs = double(vclockNow() - started) / SIM_PASSES / VCLOCK_MS;
+	printf("%d bus(es), %d blinds: %.1f ms per poll pass, %.1f requests per pass\n",
+		NUM_BUSES, SIM_BLINDS, passMs, double(g_requests) / SIM_PASSES);
+	return 0;
+}
@@ -0,0 +1,195 @@
+// Runs the gateway against a serial device in real time, such as the pty of
+// emulator.py or a USB RS-485 adapter. The virtual clock follows the wall
+// clock, the frames that the gateway puts on its TX pin are written to the
+// device, and the bytes read from it go to the receive buffer of the port.
+// The gateway starts from an empty EEPROM: it discovers the motors until
+// it has found the given number of them, the button is pressed to finish
+// the discovery, and after the reboot the blinds are moved as a group back
+// and forth. It prints how long the discovery and each move took and the
+// reply counters of the blinds. It fails if some motors weren't found or a
+// move didn't arrive.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../BusHealth.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+
+#define BLINDS_TX_PIN 16
+#define BTN_PIN 18
+// The discovery gives up on the missing motors after this long
+#define DISCOVERY_TIMEOUT (300 * VCLOCK_SEC)
+#define MOVE_TIMEOUT (120 * VCLOCK_SEC)
+// The gateway doesn't move a blind that is this close to the target, in %
+#define ARRIVED_PERCENT 2
+
+extern byte numBlinds;
+
+static int g_fd = -1;
+static std::chrono::steady_clock::time_point g_wall_start;
+static dword g_broadcasts, g_frames, g_rx_bytes;
+
+static vtime_t wallNow() {
+	return vtime_t(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - g_wall_start).count());
+}
+
+// Once per virtual millisecond: wait for the wall clock and take what the
+// device has received
+static void pace(void *ctx) {
+	vtime_t now = vclockNow();
+	vtime_t wall = wallNow();
+	if (wall < now) {
+		usleep(useconds_t(now - wall));
+	}
+	byte buf[64];
+	ssize_t n = read(g_fd, buf, sizeof(buf));
+	if (n > 0) {
+		g_rx_bytes += dword(n);
+		simBusInject(buf, byte(n));
+	}
+	vclockSchedule(now + VCLOCK_MS, pace, 0);
+}
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	g_frames++;
+	if (frame->data[0] == DISCOVER_ALL_MOTORS) {
+		g_broadcasts++;
+	}
+	if (write(g_fd, frame->data, frame->len) != frame->len) {
+		perror("write");
+	}
+}
+
+static bool openDevice(const char *path) {
+	g_fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (g_fd < 0) {
+		perror(path);
+		return false;
+	}
+	termios t;
+	if (tcgetattr(g_fd, &t) == 0) {
+		cfmakeraw(&t);
+		t.c_cflag |= PARENB | PARODD | CLOCAL | CREAD;
+		cfsetispeed(&t, B4800);
+		cfsetospeed(&t, B4800);
+		tcsetattr(g_fd, TCSANOW, &t);
+	}
+	tcflush(g_fd, TCIFLUSH);
+	return true;
+}
+
+static void reboot() {
+	g_host_reboot_requested = false;
+	g_host_pin_level[BTN_PIN] = HIGH;
+	real_setup();
+}
+
+static bool allAt(byte pct) {
+	for(byte i=0; i<numBlinds; ++i) {
+		int pos = 99 - g_channels_data[i + 1].bParam;
+		if (abs(pos - pct) > ARRIVED_PERCENT) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <serial device> <motors> [moves]\n", argv[0]);
+		return 2;
+	}
+	int motors = atoi(argv[2]);
+	if (motors < 1) {
+		fprintf(stderr, "%s: the number of motors must be at least 1\n", argv[0]);
+		return 2;
+	}
+	// The table takes this many, the rest are left out
+	byte expected = motors < MAX_BLINDS ? byte(motors) : MAX_BLINDS;
+	int moves = argc > 3 ? atoi(argv[3]) : 4;
+	if (!openDevice(argv[1])) {
+		return 1;
+	}
+	vclockReset(0);
+	g_wall_start = std::chrono::steady_clock::now();
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+	vclockSchedule(VCLOCK_MS, pace, 0);
+
+	// The empty EEPROM starts the discovery, it ends by itself when the
+	// table is full, otherwise the button ends it
+	real_setup();
+	byte found = 0;
+	vtime_t foundAt = 0;
+	while(!g_host_reboot_requested) {
+		real_loop();
+		if (numBlinds != found) {
+			found = numBlinds;
+			foundAt = vclockNow();
+		}
+		if (found >= expected || vclockNow() > DISCOVERY_TIMEOUT) {
+			// The button doesn't end a discovery that has found nothing
+			if (!found) {
+				break;
+			}
+			g_host_pin_level[BTN_PIN] = LOW;
+		}
+	}
+	printf("discovery: %u of %u motors, the last one after %.1f s and %u broadcasts\n",
+		numBlinds, expected, double(foundAt) / VCLOCK_SEC, unsigned(g_broadcasts));
+	for(byte i=0; i<numBlinds; ++i) {
+		printf("%s%02X%02X%02X", i ? " " : "  ", EEPROM.read(BLINDS_ADDR + i*3), EEPROM.read(BLINDS_ADDR + i*3 + 1),
+			EEPROM.read(BLINDS_ADDR + i*3 + 2));
+	}
+	printf("\n");
+	if (numBlinds < expected) {
+		printf("FAILED: only %u of %u motors were found in %.0f s\n", numBlinds, expected,
+			double(DISCOVERY_TIMEOUT) / VCLOCK_SEC);
+		close(g_fd);
+		return 1;
+	}
+	reboot();
+	// Let the gateway join and read the positions
+	vtime_t at = vclockNow();
+	while(vclockNow() < at + 10 * VCLOCK_SEC && !g_host_reboot_requested) {
+		real_loop();
+	}
+	resetBusHealth();
+
+	bool ok = numBlinds > 0;
+	for(int k=0; k<moves && ok; ++k) {
+		byte to = k % 2 ? 80 : 20;
+		g_channels_data[0].bParam = 99 - to;
+		g_host_channel_updated[1] = 1;
+		vtime_t commanded = vclockNow();
+		while(!allAt(to) && vclockNow() < commanded + MOVE_TIMEOUT && !g_host_reboot_requested) {
+			real_loop();
+		}
+		ok = allAt(to);
+		printf("group move to %2u%%: %s after %.1f s\n", to, ok ? "all arrived" : "FAILED",
+			double(vclockNow() - commanded) / VCLOCK_SEC);
+	}
+
+	dword requests = 0, replies = 0, retries = 0, errors = 0;
+	for(byte i=0; i<numBlinds; ++i) {
+		BusHealth *h = &g_bus_health[i];
+		requests += h->requests;
+		replies += h->replies;
+		retries += h->retries;
+		errors += h->checksumErrors + h->parityErrors + h->framingErrors;
+	}
+	printf("%u status requests, %u replies (%.1f%%), %u retries, %u receive errors\n",
+		unsigned(requests), unsigned(replies), requests ? 100.0 * replies / requests : 0.0,
+		unsigned(retries), unsigned(errors));
+	printf("%u frames sent, %u bytes received in %.1f s\n", unsigned(g_frames),
+		unsigned(g_rx_bytes), double(vclockNow()) / VCLOCK_SEC);
+	close(g_fd);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+// Bit-level simulation of the OddSoftSer receiver and transmitter.
+//
+// The receiver part feeds the GPT interrupt handler with generated 4800-8-O-1
+// waveforms that have a configurable baud rate error, edge jitter, noise
+// glitches and gaps between bytes, and reports the byte error rate.
+//
+// The transmitter part captures the waveform that the interrupt handler
+// produces for write() and checks the bit timing and levels against the
+// spec, for several values of the digitalWrite() duration (that is unknown
+// on the real hardware).
+#include "Arduino.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../OddSoftSer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#define TX_PIN SOFT_SERIAL_TX_PIN_0
+#define RX_PIN SOFT_SERIAL_RX_PIN_0
+#define DIRECTION_PIN SOFT_SERIAL_DIR_PIN_0
+#define BAUD SOFT_SERIAL_BAUD
+#define BIT_US (1000000.0 / BAUD)
+
+void softserial_gpt_handler();
+
+OddSoftSer port(TX_PIN, RX_PIN);
+
+// Deterministic pseudo-random numbers, so the runs are comparable
+// Uniform in [-1; 1]
+static double randomSigned() {
+	return (simRandom() % 20001) / 10000.0 - 1.0;
+}
+
+struct Edge {
+	double at; // us
+	byte level;
+
+	bool operator<(const Edge &other) const {
+		return at < other.at;
+	}
+};
+
+struct RxConditions {
+	double baudError; // Relative, 0.01 is a 1% too slow sender
+	double jitter;    // Maximum edge displacement, us
+	double glitchRate; // Probability of a noise glitch per bit
+	double glitchWidth; // us
+	double maxGap;    // Maximum idle time between bytes, in bits
+};
+
+static byte oddParityBit(byte d) {
+	byte ones = 0;
+	for(byte i=0; i<8; ++i) {
+		ones += (d >> i) & 1;
+	}
+	return (ones & 1) ? 0 : 1;
+}
+
+// Generate the line waveform for the bytes, starting and ending with an idle line
+static void generateWaveform(const std::vector<byte> &data, const RxConditions &cond,
+		std::vector<Edge> *edges) {
+	double bitTime = BIT_US * (1.0 + cond.baudError);
+	double t = 500.0 + (simRandom() % 1000);
+	edges->clear();
+	edges->push_back(Edge{0, HIGH});
+
+	for(size_t k=0; k<data.size(); ++k) {
+		byte bits[11];
+		bits[0] = LOW;
+		for(byte i=0; i<8; ++i) {
+			bits[i + 1] = (data[k] >> i) & 1;
+		}
+		bits[9] = oddParityBit(data[k]);
+		bits[10] = HIGH;
+
+		for(byte i=0; i<11; ++i) {
+			edges->push_back(Edge{t + cond.jitter * randomSigned(), bits[i]});
+			if (cond.glitchRate > 0 && (simRandom() % 100000) < cond.glitchRate * 100000) {
+				double at = t + (simRandom() % 1000) / 1000.0 * bitTime;
+				edges->push_back(Edge{at, byte(!bits[i])});
+				edges->push_back(Edge{at + cond.glitchWidth, bits[i]});
+			}
+			t += bitTime;
+		}
+		t += cond.maxGap * bitTime * (simRandom() % 1001) / 1000.0;
+	}
+	edges->push_back(Edge{t + 5 * bitTime, HIGH});
+	std::stable_sort(edges->begin(), edges->end());
+}
+
+// Run the interrupt handler over the waveform and collect the received bytes
+static void receiveWaveform(const std::vector<Edge> &edges, std::vector<byte> *received) {
+	double tick = g_host_gpt_period * 0.25;
+	// The timer is not synchronised with the sender
+	double t = (simRandom() % 1000) / 1000.0 * tick;
+	size_t pos = 0;
+	double end = edges.back().at;
+
+	received->clear();
+	while(t < end) {
+		while(pos + 1 < edges.size() && edges[pos + 1].at <= t) {
+			pos++;
+		}
+		g_host_pin_level[RX_PIN] = edges[pos].level;
+		softserial_gpt_handler();
+		while(port.available()) {
+			received->push_back(port.read());
+		}
+		t += tick;
+	}
+}
+
+// Byte error rate: the lost, extra and corrupted bytes over the sent ones
+static double runRx(const RxConditions &cond, int frames) {
+	std::vector<byte> data, received;
+	std::vector<Edge> edges;
+	long errors = 0, sent = 0;
+
+	for(int f=0; f<frames; ++f) {
+		// A typical status reply length
+		data.clear();
+		for(byte i=0; i<16; ++i) {
+			data.push_back(byte(simRandom()));
+		}
+		port.drain();
+		generateWaveform(data, cond, &edges);
+		receiveWaveform(edges, &received);
+
+		size_t common = std::min(data.size(), received.size());
+		for(size_t i=0; i<common; ++i) {
+			if (data[i] != received[i]) {
+				errors++;
+			}
+		}
+		errors += std::max(data.size(), received.size()) - common;
+		sent += data.size();
+	}
+	return double(errors) / sent;
+}
+
+static void rxReport() {
+	printf("RX byte error rate vs sender baud rate error\n");
+	printf("(GPT tick %.2f us, ideal half-bit %.2f us)\n\n", g_host_gpt_period * 0.25, BIT_US / 2);
+
+	const double errors[] = {-0.08, -0.06, -0.05, -0.04, -0.03, -0.02, -0.01, 0,
+		0.01, 0.02, 0.03, 0.04, 0.05, 0.06, 0.08};
+	const RxConditions conditions[] = {
+		{0, 0, 0, 0, 0},
+		{0, 10, 0, 0, 2},
+		{0, 20, 0.001, 10, 2},
+	};
+	const char *names[] = {"clean", "jitter 10us", "jitter 20us + noise"};
+
+	printf("baud error");
+	for(byte c=0; c<3; ++c) {
+		printf(" | %20s", names[c]);
+	}
+	printf("\n");
+	for(byte e=0; e<sizeof(errors)/sizeof(errors[0]); ++e) {
+		printf("%+9.0f%%", errors[e] * 100);
+		for(byte c=0; c<3; ++c) {
+			RxConditions cond = conditions[c];
+			cond.baudError = errors[e];
+			printf(" | %19.3f%%", runRx(cond, 200) * 100);
+		}
+		printf("\n");
+	}
+}
+
+// TX waveform capture
+static std::vector<Edge> g_tx_edges;
+static bool g_direction_ok;
+static double g_direction_released;
+
+static void capturePin(byte pin, byte value) {
+	if (pin == DIRECTION_PIN && value == LOW) {
+		g_direction_released = double(vclockNow());
+	}
+	if (pin == TX_PIN) {
+		g_tx_edges.push_back(Edge{double(vclockNow()), value});
+		if (!g_host_pin_level[DIRECTION_PIN]) {
+			g_direction_ok = false;
+		}
+	}
+}
+
+// Check a single byte transmission, returns the worst bit boundary error
+// in percent of the bit time, or a negative value if the levels are wrong.
+static double checkTxByte(byte d) {
+	g_tx_edges.clear();
+	g_direction_ok = true;
+	vclockAdvance(1000);
+	port.write(d);
+	port.flush();
+	// The handler releases the line at the end of the stop bit
+	double end = g_direction_released;
+
+	if (!g_direction_ok || g_host_pin_level[DIRECTION_PIN]) {
+		return -1;
+	}
+
+	byte expected[11];
+	expected[0] = LOW;
+	for(byte i=0; i<8; ++i) {
+		expected[i + 1] = (d >> i) & 1;
+	}
+	expected[9] = oddParityBit(d);
+	expected[10] = HIGH;
+
+	// The handler sets the pin for each bit, even if the level doesn't change
+	if (g_tx_edges.size() != 11) {
+		return -1;
+	}
+	double first = g_tx_edges[0].at;
+	double worst = 0;
+	for(byte i=0; i<11; ++i) {
+		if (g_tx_edges[i].level != expected[i]) {
+			return -1;
+		}
+		double err = (g_tx_edges[i].at - first) - i * BIT_US;
+		worst = std::max(worst, fabs(err));
+	}
+	// The end of the stop bit
+	double err = (end - first) - 11 * BIT_US;
+	worst = std::max(worst, fabs(err));
+	return worst / BIT_US * 100;
+}
+
+static bool txReport() {
+	printf("\nTX bit timing vs digitalWrite() duration\n");
+	printf("(a receiver sampling in the middle of the bits needs the error under 50%%,\n");
+	printf(" 25%% leaves room for the receiver's own clock error)\n\n");
+	bool ok = true;
+	for(word cost=0; cost<=10; cost += 2) {
+		g_host_digital_write_us = cost;
+		double worst = 0;
+		bool levelsOk = true;
+		for(word d=0; d<256; ++d) {
+			double err = checkTxByte(byte(d));
+			if (err < 0) {
+				levelsOk = false;
+				break;
+			}
+			worst = std::max(worst, err);
+		}
+		printf("digitalWrite %2u us: %s, worst edge error %.1f%% of a bit\n", cost,
+			levelsOk ? "levels ok" : "WRONG LEVELS", worst);
+		ok &= levelsOk;
+	}
+	g_host_digital_write_us = 0;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		simRandomSeed(atoi(argv[1]));
+	}
+	vclockReset(0);
+	port.begin();
+
+	rxReport();
+	g_host_pin_observer = capturePin;
+	bool ok = txReport();
+	g_host_pin_observer = 0;
+	return ok ? 0 : 1;
+}
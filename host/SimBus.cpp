@@ -0,0 +1,206 @@
+#include "SimBus.h"
+#include "EEPROM.h"
+#include "../Logic.h"
+#include "../OddSoftSer.h"
+
+// A new frame starts if the bus has been quiet for this long
+#define SIMBUS_FRAME_GAP (10 * VCLOCK_MS)
+
+// The decoder of a TX pin
+struct SimPort {
+	byte txPin;
+	SimFrame frame;
+	byte bitIndex; // 0 - idle, 1 - start bit was written, ...
+	byte curByte;
+	vtime_t byteStarted, lastBit;
+};
+
+static SimPort g_sim_ports[SIMBUS_MAX_PORTS];
+static byte g_num_sim_ports;
+static simbus_frame_t g_on_frame;
+static void *g_on_frame_ctx;
+
+static void frameDone(SimPort *p) {
+	p->frame.endedAt = p->lastBit + VCLOCK_SEC / 4800;
+	if (g_on_frame) {
+		g_on_frame(&p->frame, g_on_frame_ctx);
+	}
+	p->frame.len = 0;
+}
+
+// The soft serial port sets the TX pin for each of the 11 bits of the byte
+static void observePin(byte pin, byte value) {
+	SimPort *p = 0;
+	for(byte i=0; i<g_num_sim_ports; ++i) {
+		if (g_sim_ports[i].txPin == pin) {
+			p = &g_sim_ports[i];
+		}
+	}
+	if (!p) {
+		return;
+	}
+	vtime_t now = vclockNow();
+	if (p->bitIndex == 0) {
+		if (value != LOW) {
+			return; // Idle line
+		}
+		if (p->frame.len && now - p->lastBit > SIMBUS_FRAME_GAP) {
+			p->frame.len = 0; // An incomplete frame, drop it
+		}
+		p->byteStarted = now;
+		p->curByte = 0;
+		p->bitIndex = 1;
+		p->lastBit = now;
+		return;
+	}
+
+	p->lastBit = now;
+	if (p->bitIndex <= 8) {
+		p->curByte |= value << (p->bitIndex - 1);
+	}
+	if (++p->bitIndex < 11) {
+		return;
+	}
+	p->bitIndex = 0;
+
+	if (p->frame.len == 0) {
+		p->frame.startedAt = p->byteStarted;
+	}
+	if (p->frame.len < SIMBUS_MAX_FRAME) {
+		p->frame.data[p->frame.len++] = p->curByte;
+	}
+	// The length byte is 0xFF - the total frame length
+	if (p->frame.len >= 2 && p->frame.len >= byte(0xFF - p->frame.data[1])) {
+		frameDone(p);
+	}
+}
+
+void simBusAttachPort(byte port, byte txPin) {
+	SimPort *p = &g_sim_ports[port];
+	p->txPin = txPin;
+	p->frame.port = port;
+	p->frame.len = 0;
+	p->bitIndex = 0;
+	if (port >= g_num_sim_ports) {
+		g_num_sim_ports = port + 1;
+	}
+	g_host_pin_observer = observePin;
+}
+
+void simBusAttach(byte txPin, simbus_frame_t onFrame, void *ctx) {
+	g_on_frame = onFrame;
+	g_on_frame_ctx = ctx;
+	g_num_sim_ports = 0;
+	simBusAttachPort(0, txPin);
+}
+
+void simBusDetach() {
+	g_host_pin_observer = 0;
+	g_on_frame = 0;
+	g_num_sim_ports = 0;
+}
+
+void simBusInjectPort(byte port, const byte *data, byte len) {
+	SoftSerPort *p = &g_ports[port];
+	for(byte i=0; i<len; ++i) {
+		p->rcv_buff[p->write_pos] = data[i];
+		p->write_pos = (p->write_pos + 1) & (MAX_RCV_BUFFER - 1);
+	}
+}
+
+void simBusInject(const byte *data, byte len) {
+	simBusInjectPort(0, data, len);
+}
+
+// The simulated motors
+
+#if WATCHDOG_ADDR >= HOST_EEPROM_SIZE
+#error "The EEPROM layout doesn't fit into the host EEPROM"
+#endif
+
+static dword g_sim_seed = 1;
+
+void simMotorsInit(SimMotor *motors, byte count) {
+	for(byte i=0; i<count; ++i) {
+		motors[i].addr[0] = 0x10 + i;
+		motors[i].addr[1] = 0x20;
+		motors[i].addr[2] = 0x30;
+		motors[i].port = 0;
+		motors[i].len = motors[i].sent = 0;
+	}
+}
+
+SimMotor *simFindMotor(SimMotor *motors, byte count, const byte *addr) {
+	for(byte i=0; i<count; ++i) {
+		if (!memcmp(motors[i].addr, addr, 3)) {
+			return &motors[i];
+		}
+	}
+	return 0;
+}
+
+void simSeedEeprom(const SimMotor *motors, byte count) {
+	EEPROM.write(MODE_ADDR, 2); // OPERATION
+	EEPROM.write(NUM_BLINDS_ADDR, count);
+	for(byte i=0; i<count; ++i) {
+		for(byte k=0; k<3; ++k) {
+			EEPROM.write(BLINDS_ADDR + i*3 + k, motors[i].addr[k]);
+		}
+		EEPROM.write(BUS_MAP_ADDR + i, motors[i].port);
+	}
+	// Only the writes of the gateway count
+	EEPROM.writes = 0;
+}
+
+void simChecksum(byte *frame, byte len) {
+	word checksum = 0;
+	for(byte i=0; i<len - 2; ++i) {
+		checksum += frame[i];
+	}
+	frame[len - 2] = byte(checksum / 256);
+	frame[len - 1] = byte(checksum % 256);
+}
+
+void simPositionFrame(byte *frame, const byte *addr, byte pct, word ticks) {
+	byte data[SIM_POSITION_LEN] = {HERE_IS_POSITION, 0xF0u, 0xFFu, addr[0], addr[1], addr[2],
+		0x80u, 0x80u, 0x80u, byte(ticks), byte(ticks >> 8), byte(0xFFu - pct), 0x00, 0x00, 0x00};
+	memcpy(frame, data, sizeof(data));
+	simChecksum(frame, SIM_POSITION_LEN);
+}
+
+static void sendMotorByte(void *ctx) {
+	SimMotor *m = (SimMotor*) ctx;
+	simBusInjectPort(m->port, &m->data[m->sent], 1);
+	if (++m->sent < m->len) {
+		vclockSchedule(vclockNow() + SIM_BYTE_TIME, sendMotorByte, m);
+	}
+}
+
+void simMotorSend(SimMotor *m, const byte *frame, byte len, vtime_t at) {
+	memcpy(m->data, frame, len);
+	simChecksum(m->data, len);
+	m->len = len;
+	m->sent = 0;
+	vclockSchedule(at, sendMotorByte, m);
+}
+
+void simMotorReply(SimMotor *m, byte pct, word ticks, vtime_t at) {
+	byte frame[SIM_POSITION_LEN];
+	simPositionFrame(frame, m->addr, pct, ticks);
+	simMotorSend(m, frame, sizeof(frame), at);
+}
+
+void simMotorAnnounce(SimMotor *m, vtime_t at) {
+	byte frame[SIM_MOTOR_LEN] = {HERE_IS_MOTOR, 0xF7u, 0xFFu, m->addr[0], m->addr[1],
+		m->addr[2], 0x00, 0x00};
+	simMotorSend(m, frame, sizeof(frame), at);
+}
+
+void simRandomSeed(dword seed) {
+	g_sim_seed = seed;
+}
+
+dword simRandom() {
+	g_sim_seed = g_sim_seed * 1103515245u + 12345u;
+	return g_sim_seed >> 8;
+}
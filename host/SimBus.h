@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Arduino.h"
+#include "VirtualClock.h"
+
+// The RS-485 buses as seen by the gateway in the host build. It decodes the
+// frames that the soft serial ports put on their TX pins, and injects
+// replies directly into the receive buffers of the ports.
+
+#define SIMBUS_MAX_FRAME 64
+#define SIMBUS_MAX_PORTS 4
+
+struct SimFrame {
+	byte port;
+	byte data[SIMBUS_MAX_FRAME];
+	byte len;
+	// Start of the first start bit and end of the last stop bit
+	vtime_t startedAt, endedAt;
+};
+
+typedef void (*simbus_frame_t)(const SimFrame *frame, void *ctx);
+
+// Start decoding the writes to the TX pin of the port 0
+void simBusAttach(byte txPin, simbus_frame_t onFrame, void *ctx);
+// Decode one more port, its frames go to the same callback
+void simBusAttachPort(byte port, byte txPin);
+void simBusDetach();
+
+// Make the bytes available to OddSoftSer::read() of the port 0
+void simBusInject(const byte *data, byte len);
+void simBusInjectPort(byte port, const byte *data, byte len);
+
+// The simulated motors. They answer on the bus of their port at the real
+// byte rate, the sims decide what they answer from the frames they get.
+
+// The frames of the Somfy protocol that the sims use
+#define DISCOVER_ALL_MOTORS 0xBFu
+#define HERE_IS_MOTOR 0x9Fu
+#define REPORT_MOTOR_STATUS 0xF3u
+#define HERE_IS_POSITION 0xF2u
+#define MOVE_MOTOR_TO_POS 0xFCu
+#define STOP_MOTOR 0xFDu
+#define SIM_POSITION_LEN 15
+#define SIM_MOTOR_LEN 8
+
+// 4800 baud with 8 data bits, a parity and a stop bit
+#define SIM_BYTE_TIME (VCLOCK_SEC * 11 / 4800)
+// A motor starts to reply this long after the request
+#define SIM_REPLY_DELAY (5 * VCLOCK_MS)
+
+struct SimMotor {
+	byte addr[3];
+	byte port;
+	// The frame that is being put on the bus, a byte at a time
+	byte data[SIM_POSITION_LEN];
+	byte len, sent;
+};
+
+// Give the motors the addresses 10 20 30, 11 20 30, ... on the port 0
+void simMotorsInit(SimMotor *motors, byte count);
+SimMotor *simFindMotor(SimMotor *motors, byte count, const byte *addr);
+// A gateway in the operation mode that has discovered the motors, on the
+// buses of their ports
+void simSeedEeprom(const SimMotor *motors, byte count);
+
+// Fill in the checksum of the frame, the last two bytes
+void simChecksum(byte *frame, byte len);
+// The HERE_IS_POSITION reply of the motor with the given address,
+// SIM_POSITION_LEN bytes
+void simPositionFrame(byte *frame, const byte *addr, byte pct, word ticks);
+// Put the frame on the bus starting at the given time, the checksum is
+// filled in. A frame that is still being sent is cut short.
+void simMotorSend(SimMotor *m, const byte *frame, byte len, vtime_t at);
+// Reply to a status request
+void simMotorReply(SimMotor *m, byte pct, word ticks, vtime_t at);
+// Reply to a discovery broadcast
+void simMotorAnnounce(SimMotor *m, vtime_t at);
+
+// The pseudo-random numbers of the sims, the same on every run
+void simRandomSeed(dword seed);
+dword simRandom();
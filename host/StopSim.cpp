@@ -0,0 +1,79 @@
+// Measures the latency from a Z-Wave stop request to the stop frame on the
+// bus. Stop requests arrive at random times while the gateway is polling,
+// commanding the blinds and idling. The motors don't reply, so the polling
+// runs through all its retries, which is the worst case for the latency.
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "VirtualClock.h"
+#include "SimBus.h"
+#include "../Logic.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define SIM_BLINDS 3
+#define STOP_REQUESTS 500
+#define BLINDS_TX_PIN 16
+
+void real_setup();
+void real_loop();
+void zunoSWMLCallback(byte dir, byte channel);
+
+static vtime_t g_requested_at;
+static bool g_pending;
+static std::vector<double> g_latencies;
+
+static void onFrame(const SimFrame *frame, void *ctx) {
+	// A copy of an earlier stop that was already on the wire doesn't count
+	if (g_pending && frame->data[0] == STOP_MOTOR && frame->startedAt >= g_requested_at) {
+		g_latencies.push_back((frame->startedAt - g_requested_at) / 1000.0);
+		g_pending = false;
+	}
+}
+
+static void requestStop(void *ctx) {
+	if ((simRandom() % 3) == 0) {
+		// Keep the blinds busy most of the time
+		g_channels_data[0].bParam = simRandom() % 100;
+		g_host_channel_updated[1] = 1;
+		return;
+	}
+	g_requested_at = vclockNow();
+	g_pending = true;
+	zunoSWMLCallback(0, 1);
+}
+
+int main() {
+	SimMotor motors[SIM_BLINDS];
+	simMotorsInit(motors, SIM_BLINDS);
+	simSeedEeprom(motors, SIM_BLINDS);
+	vclockReset(0);
+	simBusAttach(BLINDS_TX_PIN, onFrame, 0);
+
+	vtime_t at = 5 * VCLOCK_SEC;
+	for(int i=0; i<STOP_REQUESTS * 3 / 2; ++i) {
+		at += VCLOCK_MS * (500 + simRandom() % 10000);
+		vclockSchedule(at, requestStop, 0);
+	}
+
+	real_setup();
+	while(vclockNow() < at + 10 * VCLOCK_SEC) {
+		real_loop();
+	}
+
+	std::sort(g_latencies.begin(), g_latencies.end());
+	size_t n = g_latencies.size();
+	if (n == 0) {
+		printf("No stop frames were sent\n");
+		return 1;
+	}
+	double sum = 0;
+	for(size_t i=0; i<n; ++i) {
+		sum += g_latencies[i];
+	}
+	printf("Stop request to wire latency over %u requests, ms:\n", unsigned(n));
+	printf("min %.2f, avg %.2f, p50 %.2f, p99 %.2f, max %.2f\n", g_latencies[0],
+		sum / n, g_latencies[n / 2], g_latencies[n * 99 / 100], g_latencies[n - 1]);
+	return g_pending ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Arduino.h"
+
+class Stream : public Print {
+public:
+	virtual uint8_t available(void) = 0;
+	virtual int peek(void) = 0;
+	virtual uint8_t read(void) = 0;
+	virtual void flush(void) = 0;
+};
@@ -0,0 +1,67 @@
+#include "VirtualClock.h"
+
+#include <queue>
+#include <vector>
+
+struct ScheduledEvent {
+	vtime_t at;
+	unsigned long long seq;
+	vclock_event_t event;
+	void *ctx;
+
+	bool operator>(const ScheduledEvent &other) const {
+		if (at != other.at) {
+			return at > other.at;
+		}
+		return seq > other.seq;
+	}
+};
+
+static vtime_t g_now = 0;
+static unsigned long long g_seq = 0;
+static std::priority_queue<ScheduledEvent, std::vector<ScheduledEvent>,
+	std::greater<ScheduledEvent> > g_events;
+
+void vclockReset(vtime_t start) {
+	g_now = start;
+	g_seq = 0;
+	while(!g_events.empty()) {
+		g_events.pop();
+	}
+}
+
+vtime_t vclockNow() {
+	return g_now;
+}
+
+void vclockAdvance(vtime_t us) {
+	vtime_t target = g_now + us;
+	// Events can schedule other events, always re-check the queue head
+	while(!g_events.empty() && g_events.top().at <= target) {
+		ScheduledEvent ev = g_events.top();
+		g_events.pop();
+		if (ev.at > g_now) {
+			g_now = ev.at;
+		}
+		ev.event(ev.ctx);
+	}
+	g_now = target;
+}
+
+bool vclockRunNext() {
+	if (g_events.empty()) {
+		return false;
+	}
+	vtime_t at = g_events.top().at;
+	vclockAdvance(at > g_now ? at - g_now : 0);
+	return true;
+}
+
+void vclockSchedule(vtime_t at, vclock_event_t event, void *ctx) {
+	ScheduledEvent ev;
+	ev.at = at;
+	ev.seq = g_seq++;
+	ev.event = event;
+	ev.ctx = ctx;
+	g_events.push(ev);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// Deterministic simulated time for the host build. Nothing waits in real
+// time: delay() and delayMicroseconds() move the clock forward instantly,
+// stopping at each scheduled event on the way to run it.
+//
+// The clock counts microseconds in 64 bits, millis() and micros() truncate
+// it to 32 bits just like the hardware counters, so the wraparound after
+// 49.7 days can be reached by starting the clock close to it.
+
+typedef unsigned long long vtime_t;
+typedef void (*vclock_event_t)(void *ctx);
+
+#define VCLOCK_MS 1000ull
+#define VCLOCK_SEC (1000ull * VCLOCK_MS)
+#define VCLOCK_HOUR (3600ull * VCLOCK_SEC)
+#define VCLOCK_DAY (24ull * VCLOCK_HOUR)
+#define VCLOCK_MILLIS_WRAP (0x100000000ull * VCLOCK_MS)
+
+// Drop all the scheduled events and set the current time
+void vclockReset(vtime_t start);
+vtime_t vclockNow();
+
+// Move the time forward, running the events that become due
+void vclockAdvance(vtime_t us);
+// Jump to the next scheduled event and run it, returns false if there are none
+bool vclockRunNext();
+
+// Run the callback once the clock reaches the given time. Events scheduled
+// for the same time run in the order they were added.
+void vclockSchedule(vtime_t at, vclock_event_t event, void *ctx);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "Arduino.h"
+
+// I2C master that only counts the traffic
+class TwoWire {
+public:
+	void begin();
+	void beginTransmission(byte addr);
+	void write(byte value);
+	byte endTransmission();
+
+	dword transmissions;
+	dword bytesWritten;
+	// Make the device NACK its address
+	bool nack;
+};
+
+extern TwoWire Wire;
@@ -0,0 +1,103 @@
+# Decodes the binary event log (see DebugLog.h) sent over the debug serial.
+# Text output of the gateway is passed through as is.
+#
+# Usage: python logdecoder.py /dev/ttyUSB0   - read from the serial port
+#        python logdecoder.py dump.bin       - decode a captured dump
+import os
+import sys
+
+LOG_SYNC = 0xA5
+RECORD_LEN = 10
+
+EVENTS = {
+    1: "log overflow, %(arg)d records were dropped",
+    2: "new pos for blind %(blind)d is %(arg)d",
+    3: "blind %(blind)d is offline",
+    4: "discovered new motor: %(addr)s",
+    5: "received command for all blinds to move to %(arg)d",
+    6: "received direct command for blind %(blind)d to %(arg)d",
+    7: "commanding blind %(blind)d to move up to the limit",
+    8: "commanding blind %(blind)d to move down to the limit",
+    9: "commanding blind %(blind)d to move to position %(arg)d",
+    10: "blind %(blind)d has been commanded to stop",
+    11: "blind %(blind)d has finished moving",
+    12: "blind %(blind)d has timed out while moving",
+    13: "sending an important report",
+    14: "sending a routine report",
+    15: "OLED is not responding, resetting it",
+    16: "group move of %(blind)d blinds planned, arrival spread %(arg)d ms",
+    17: "group move of %(blind)d blinds arrived, arrival spread %(arg)d ms",
+    18: "running scene %(arg)d with %(blind)d blinds",
+    19: "stored scene %(arg)d with %(blind)d blinds",
+    20: "online discovery %(state)s, %(blind)d motors added",
+    21: "loop over the budget, %(phase)s took %(arg)d ms",
+    22: "rebooted by the watchdog in %(phase)s",
+}
+
+# The loop phases, see LoopStats.h
+PHASES = ["zwave", "commands", "read states", "print status", "detect jams", "report",
+          "delay", "button", "discovery"]
+
+
+def decode_record(rec):
+    event, blind = rec[1], rec[2]
+    arg = rec[3] + rec[4] * 256
+    timestamp = rec[5] + (rec[6] << 8) + (rec[7] << 16) + (rec[8] << 24)
+    fmt = EVENTS.get(event, "unknown event %(event)d, blind %(blind)d, arg %(arg)d")
+    addr = "%X %X %X" % (blind, arg >> 8, arg & 0xFF)
+    state = "started" if arg else "ended"
+    phase = PHASES[blind] if blind < len(PHASES) else "phase %d" % blind
+    text = fmt % {"event": event, "blind": blind, "arg": arg, "addr": addr, "state": state,
+                  "phase": phase}
+    return "[%10.3f] %s" % (timestamp / 1000.0, text)
+
+
+def is_record(buf):
+    return len(buf) >= RECORD_LEN and buf[0] == LOG_SYNC and \
+        sum(buf[:RECORD_LEN - 1]) & 0xFF == buf[RECORD_LEN - 1]
+
+
+def decode(chunks, out):
+    buf = bytearray()
+    for chunk in chunks:
+        buf += chunk
+        while buf:
+            if buf[0] != LOG_SYNC:
+                out.write(chr(buf[0]))
+                del buf[0]
+                continue
+            if len(buf) < RECORD_LEN:
+                break
+            if is_record(buf):
+                out.write(decode_record(buf) + "\n")
+                del buf[:RECORD_LEN]
+            else:
+                # Not a record after all, just a byte of text
+                out.write(chr(buf[0]))
+                del buf[0]
+        out.flush()
+
+
+def read_file(f):
+    while True:
+        chunk = f.read(256)
+        if not chunk:
+            return
+        yield chunk
+
+
+def read_serial(port):
+    import serial
+    ser = serial.Serial(port, 115200, timeout=1)
+    while True:
+        yield ser.read(256)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2 or sys.argv[1] == "-":
+        decode(read_file(sys.stdin.buffer), sys.stdout)
+    elif os.path.isfile(sys.argv[1]):
+        with open(sys.argv[1], "rb") as f:
+            decode(read_file(f), sys.stdout)
+    else:
+        decode(read_serial(sys.argv[1]), sys.stdout)